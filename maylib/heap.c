@@ -1,16 +1,60 @@
 #include "heap.h"
 #include "mem.h"
 #include <assert.h>
+#include <sys/mman.h>
+
+#define HEAP_HUGE_PAGE_SIZE (2*1024*1024)
+/* allocations bigger than quarter of block get own block */
+#define HEAP_IS_LARGE(h, sz) ((sz)*4 > (h)->block_size)
+
+static void *block_alloc(int flags, size_t sz) {
+#ifdef MADV_HUGEPAGE
+	if(flags & HEAP_HUGE_PAGES) {
+		void *p = mmap(0, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		err_reset();
+		if(p==MAP_FAILED) {
+			err_set(e_out_of_memory);
+			return 0;
+		}
+		madvise(p, sz, MADV_HUGEPAGE);
+		return p;
+	}
+#endif
+	return mem_alloc(sz);
+}
+
+static void block_free(int flags, void *p, size_t sz) {
+#ifdef MADV_HUGEPAGE
+	if(flags & HEAP_HUGE_PAGES) {
+		munmap(p, sz);
+		return;
+	}
+#endif
+	mem_free(p);
+}
 
 heap_t heap_create(size_t block_size) {
+	return heap_create_ex(block_size, 0);
+}
+
+heap_t heap_create_ex(size_t block_size, int flags) {
 	heap_t res;
 	err_reset();
 	if(block_size==0)
 		block_size = 64*1024;
-	res = mem_alloc(sizeof(heap_s) + block_size);
+	block_size = HEAP_ROUND(block_size);
+	if(flags & HEAP_HUGE_PAGES) {
+		size_t sz = HEAP_BLOCK_HEADER_SIZE + block_size;
+		sz = (sz + HEAP_HUGE_PAGE_SIZE - 1) & ~(size_t)(HEAP_HUGE_PAGE_SIZE - 1);
+		block_size = sz - HEAP_BLOCK_HEADER_SIZE;
+	}
+	res = block_alloc(flags, sizeof(heap_s) + block_size);
 	if(!err()) {
 		res->block_size = block_size;
+		res->flags = flags;
 		res->last = &res->first;
+		res->large = 0;
+		res->cleanup = 0;
 		res->first.size = block_size;
 		res->first.used = 0;
 		res->first.next = 0;
@@ -18,33 +62,146 @@ heap_t heap_create(size_t block_size) {
 	return res;
 }
 
+static void heap_cleanup(heap_t h, heap_cleanup_t *until) {
+	while(h->cleanup!=until) {
+		heap_cleanup_t *c = h->cleanup;
+		h->cleanup = c->next;
+		c->f(c->data);
+	}
+}
+
+static void heap_free_large(heap_t h, heap_block_t *until) {
+	while(h->large!=until) {
+		heap_block_t *b = h->large;
+		h->large = b->next;
+		block_free(h->flags, b, HEAP_BLOCK_HEADER_SIZE + b->size);
+	}
+}
+
 heap_t heap_delete(heap_t h) {
 	if(h) {
-		heap_block_t *p = h->first.next;
+		heap_block_t *p;
+		heap_cleanup(h, 0);
+		heap_free_large(h, 0);
+		p = h->first.next;
 		while(p) {
 			heap_block_t *tmp = p->next;
-			mem_free(p);
+			block_free(h->flags, p, HEAP_BLOCK_HEADER_SIZE + p->size);
 			p = tmp;
 		}
-		mem_free(h);
+		block_free(h->flags, h, sizeof(heap_s) + h->block_size);
 	}
 	return 0;
 }
 
-void *heap_slow_alloc(heap_t h, size_t sz) {
-	heap_block_t *b;
-	size_t block_sz = (sz*16<=h->block_size) ? h->block_size : sz*16;
-	b = h->last->next = mem_alloc(sizeof(heap_s) + block_sz);
+heap_t heap_reset(heap_t h) {
+	heap_cleanup(h, 0);
+	heap_free_large(h, 0);
+	h->first.used = 0;
+	h->last = &h->first;
+	return h;
+}
+
+heap_mark_t heap_mark(heap_t h) {
+	heap_mark_t m;
+	m.block = h->last;
+	m.used = h->last->used;
+	m.large = h->large;
+	m.cleanup = h->cleanup;
+	return m;
+}
+
+heap_t heap_release(heap_t h, heap_mark_t m) {
+	heap_cleanup(h, m.cleanup);
+	heap_free_large(h, m.large);
+	h->last = m.block;
+	h->last->used = m.used;
+	return h;
+}
+
+void heap_on_delete(heap_t h, void (*f)(void *), void *data) {
+	heap_cleanup_t *c = heap_alloc(h, sizeof(heap_cleanup_t));
 	if(!err()) {
-		h->last = h->last->next;
-		b->size = block_sz;
-		b->used = sz;
-		b->next = 0;
-		return &(b->data[0]);
+		c->f = f;
+		c->data = data;
+		c->next = h->cleanup;
+		h->cleanup = c;
 	}
-	return 0;
 }
 
+heap_stat_t heap_stat(heap_t h) {
+	heap_stat_t r;
+	heap_block_t *b;
+	int active = 1;
+	r.used = r.reserved = r.blocks = r.large_blocks = 0;
+	for(b=&h->first; b; b=b->next) {
+		/* blocks after last are kept for reuse only */
+		if(active)
+			r.used += b->used;
+		if(b==h->last)
+			active = 0;
+		r.reserved += b->size;
+		r.blocks++;
+	}
+	for(b=h->large; b; b=b->next) {
+		r.used += b->size;
+		r.reserved += b->size;
+		r.large_blocks++;
+	}
+	return r;
+}
 
+void *heap_slow_alloc(heap_t h, size_t sz) {
+	heap_block_t *b;
+	if(HEAP_IS_LARGE(h, sz)) {
+		/* own block, so free tail of the last block is not lost */
+		b = block_alloc(h->flags, HEAP_BLOCK_HEADER_SIZE + sz);
+		if(err())
+			return 0;
+		b->size = b->used = sz;
+		b->next = h->large;
+		h->large = b;
+		return &(b->data[0]);
+	}
+	if(h->last->next) {
+		/* block kept by heap_reset or heap_release */
+		h->last = h->last->next;
+		h->last->used = sz;
+		return &(h->last->data[0]);
+	}
+	b = block_alloc(h->flags, HEAP_BLOCK_HEADER_SIZE + h->block_size);
+	if(err())
+		return 0;
+	b->size = h->block_size;
+	b->used = sz;
+	b->next = 0;
+	h->last->next = b;
+	h->last = b;
+	return &(b->data[0]);
+}
 
+void *heap_alloc_aligned(heap_t h, size_t sz, size_t align) {
+	size_t pad;
+	char *p;
+	assert(align && !(align & (align - 1)));
+	if(align<=HEAP_ALIGN)
+		return heap_alloc(h, sz);
+	pad = (align - ((size_t)(h->last->data + h->last->used) & (align - 1))) & (align - 1);
+	if(h->last->size - h->last->used >= pad + HEAP_ROUND(sz)) {
+		h->last->used += pad;
+		return heap_alloc(h, sz);
+	}
+	p = heap_slow_alloc(h, HEAP_ROUND(sz + align - 1));
+	if(err())
+		return 0;
+	return p + ((align - ((size_t)p & (align - 1))) & (align - 1));
+}
 
+void heap_shrink(heap_t h, void *p, size_t sz, size_t new_sz) {
+	heap_block_t *b = h->last;
+	sz = HEAP_ROUND(sz);
+	new_sz = HEAP_ROUND(new_sz);
+	assert(new_sz<=sz);
+	if((char *)p + sz==b->data + b->used && b->used>=sz)
+		b->used -= sz - new_sz;
+}
@@ -12,25 +12,86 @@ typedef struct heap_block_s {
 	char data[1];
 } heap_block_t;
 
+typedef struct heap_cleanup_s {
+	void (*f)(void *);
+	void *data;
+	struct heap_cleanup_s *next;
+} heap_cleanup_t;
+
 typedef struct {
 	size_t block_size;
+	int flags;
 	heap_block_t *last;
+	heap_block_t *large;
+	heap_cleanup_t *cleanup;
 	heap_block_t first;
 } heap_s;
 
 typedef heap_s *heap_t;
 
+/**
+ * Allocation position, see heap_mark.
+ */
+typedef struct {
+	heap_block_t *block;
+	size_t used;
+	heap_block_t *large;
+	heap_cleanup_t *cleanup;
+} heap_mark_t;
+
+typedef struct {
+	size_t used;
+	size_t reserved;
+	size_t blocks;
+	size_t large_blocks;
+} heap_stat_t;
+
+/**
+ * Back blocks with huge pages (if system supports it).
+ */
+#define HEAP_HUGE_PAGES 1
+
+/**
+ * Every allocation is aligned to HEAP_ALIGN.
+ */
+#define HEAP_ALIGN (sizeof(void *))
+#define HEAP_ROUND(sz) (((sz) + HEAP_ALIGN - 1) & ~(HEAP_ALIGN - 1))
+#define HEAP_BLOCK_HEADER_SIZE offsetof(heap_block_t, data)
+
 heap_t heap_create(size_t block_size);
+heap_t heap_create_ex(size_t block_size, int flags);
 heap_t heap_delete(heap_t);
+/**
+ * Forget all allocations but keep blocks for reuse.
+ */
+heap_t heap_reset(heap_t);
+/**
+ * Remember position, heap_release frees everything allocated after it.
+ * Blocks are kept for reuse, except blocks of large allocations.
+ */
+heap_mark_t heap_mark(heap_t);
+heap_t heap_release(heap_t, heap_mark_t);
+/**
+ * Call f(data) when heap is deleted or reset (in reverse order).
+ * Used to release resources referenced from heap memory.
+ */
+void heap_on_delete(heap_t, void (*f)(void *), void *data);
+/**
+ * Count memory of heap. Walks all blocks, so it is not for hot paths.
+ */
+heap_stat_t heap_stat(heap_t);
 
 /* void *heap_alloc(heap_t, size_t); */
 void *heap_slow_alloc(heap_t, size_t);
-#define heap_alloc(h, sz) ((((h)->last->size - (h)->last->used)>=(sz)) \
-	? (((h)->last->used+=(sz)),&((h)->last->data[(h)->last->used-(sz)])) \
-	: heap_slow_alloc(h,(sz)))
+void *heap_alloc_aligned(heap_t, size_t, size_t align);
+/**
+ * Give back end of the newest allocation p of size sz, so only new_sz
+ * bytes are kept. Does nothing if anything was allocated after p.
+ */
+void heap_shrink(heap_t, void *p, size_t sz, size_t new_sz);
+#define heap_alloc(h, sz) ((((h)->last->size - (h)->last->used)>=HEAP_ROUND(sz)) \
+	? (((h)->last->used+=HEAP_ROUND(sz)),&((h)->last->data[(h)->last->used-HEAP_ROUND(sz)])) \
+	: heap_slow_alloc(h,HEAP_ROUND(sz)))
 
 
 #endif /* MAY_HEAP_H */
-
-
-
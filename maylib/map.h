@@ -1,4 +1,3 @@
-
 #ifndef MAY_MAP_H
 #define MAY_MAP_H
 
@@ -7,10 +6,10 @@
 
 typedef struct map_node_ss {
 	str_t key;
+	size_t hash;    /* str_hash of key */
 	void *value;
-	size_t length;
-	struct map_node_ss *children[2];
-	struct map_node_ss *parent;
+	struct map_node_ss *next;        /* next node of bucket */
+	struct map_node_ss *order[2];    /* previous and next inserted node */
 } map_node_s;
 
 typedef map_node_s *map_node_t;
@@ -18,12 +17,24 @@ typedef map_node_s *map_node_t;
 typedef struct map_ss {
 	heap_t heap;
 	size_t length;
-	map_node_t node;
+	size_t size;    /* number of buckets, power of two */
+	map_node_t *buckets;
+	map_node_t first;
+	map_node_t last;
 } map_s;
 
 typedef map_s *map_t;
 
+/**
+ * Hash table with chaining. Hashes are cached in keys (see str_hash),
+ * so a lookup usually touches one bucket and compares one key.
+ * Iteration goes in order of insertion.
+ */
 map_t map_create(heap_t h);
+/**
+ * Resize table to the number of keys (it grows automatically, so it's
+ * only needed after many removals).
+ */
 map_t map_optimize(map_t);
 map_t map_set(map_t, str_t key, void *value);
 void *map_get(map_t, str_t key);
@@ -33,4 +44,3 @@ map_node_t map_next(map_node_t);
 
 
 #endif /* MAY_MAP_H */
-
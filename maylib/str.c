@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
 
 #define INT_BUFFER_LEN 16
 #define DOUBLE_BUFFER_LEN 128
@@ -14,6 +15,7 @@ str_t str_create(heap_t h, size_t sz) {
 	if(r) {
 		r->data = ((char *)r) + sizeof(may_str_s);
 		r->length = sz;
+		r->hash = 0;
 		r->data[sz] = 0;
 	}
 	return r;
@@ -75,10 +77,18 @@ str_t str_interval(heap_t h, str_it_t ps1, str_it_t ps2) {
 	str_t res;
 	assert(h);
 	assert((ps1 && ps2) || (!ps1 && !ps2));
+	if(ps1 && ps2 - ps1<=STR_INLINE_SIZE) {
+		/* short names are compared often, keep them next to header */
+		res = str_create(h, ps2 - ps1);
+		if(res)
+			memcpy(res->data, ps1, ps2 - ps1);
+		return res;
+	}
 	res = heap_alloc(h, sizeof(may_str_s));
 	if(res) {
 		res->length = ps2-ps1;
 		res->data = ps1;
+		res->hash = 0;
 	}
 	return res;
 }
@@ -144,13 +154,10 @@ str_t sbuilder_get(heap_t h, sbuilder_t sb) {
 int str_compare(str_t s1, str_t s2) {
 	if(s1 && s2) {
 		if(s1!=s2) {
-			str_it_t i, j;
-			int c = s1->length>s2->length ? s2->length : s1->length;
-			for(i=s1->data, j=s2->data; c; c--, i++, j++)
-				if(*i<*j)
-					return -1;
-				else if(*i>*j)
-					return 1;
+			size_t c = s1->length>s2->length ? s2->length : s1->length;
+			int r = memcmp(s1->data, s2->data, c);
+			if(r)
+				return r<0 ? -1 : 1;
 			if(s1->length<s2->length)
 				return -1;
 			else if(s1->length>s2->length)
@@ -165,14 +172,35 @@ int str_compare(str_t s1, str_t s2) {
 
 int str_equal(str_t s1, str_t s2) {
 	if(s1 && s2) {
-		if(s1->length!=s2->length)
+		if(s1==s2)
+			return 1;
+		if(s1->length!=s2->length || (s1->hash && s2->hash && s1->hash!=s2->hash))
 			return 0;
-		else
-			return !str_compare(s1, s2);
+		return !memcmp(s1->data, s2->data, s1->length);
 	} else {
 		err_set(e_arguments);
 		return 0;
 	}
 }
 
-
+size_t str_calc_hash(str_t s) {
+	const unsigned char *p = (const unsigned char *)s->data;
+	size_t n = s->length;
+	uint64_t h = 0x9E3779B97F4A7C15ull ^ n, w;
+	/* 8 bytes at a time, multiply and rotate */
+	for(; n>=8; n-=8, p+=8) {
+		memcpy(&w, p, 8);
+		h = (h ^ w)*0xFF51AFD7ED558CCDull;
+		h = (h<<31) | (h>>33);
+	}
+	if(n) {
+		w = 0;
+		memcpy(&w, p, n);
+		h = (h ^ w)*0xFF51AFD7ED558CCDull;
+	}
+	h ^= h>>29;
+	h *= 0xC4CEB9FE1A85EC53ull;
+	h ^= h>>32;
+	s->hash = h ? (size_t)h : 1;
+	return s->hash;
+}
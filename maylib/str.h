@@ -9,6 +9,7 @@
 typedef struct {
 	size_t length;
 	char *data;
+	size_t hash;    /* zero until str_hash is called */
 } may_str_s;
 
 typedef may_str_s *str_t;
@@ -28,14 +29,28 @@ str_t str_cat(heap_t, str_t, str_t);
 str_it_t str_end(str_t);
 
 /**
- * WARNING This function don't clone content of string. (use str_copy)
- * WARNING This function returns no zero-ended string. (use str_copy)
+ * Intervals up to STR_INLINE_SIZE bytes are copied next to the string,
+ * longer ones point to the original content.
+ * WARNING This function don't clone content of long string. (use str_clone)
+ * WARNING This function returns no zero-ended string. (use str_clone)
  */
+#define STR_INLINE_SIZE 16
 str_t str_interval(heap_t, str_it_t, str_it_t);
 
 str_t str_clone(heap_t, str_t);
 int str_compare(str_t, str_t);
+/**
+ * Uses cached hashes of strings (if both are computed) to reject
+ * different strings early.
+ */
 int str_equal(str_t, str_t);
+/**
+ * Hash is computed once and cached in the string, so content of string
+ * must not be changed after str_hash was called. Never returns zero.
+ */
+/* size_t str_hash(str_t); */
+#define str_hash(s) ((s)->hash ? (s)->hash : str_calc_hash(s))
+size_t str_calc_hash(str_t);
 /*size_t str_length(str_t);*/
 #define str_length(s) ((s)->length)
 
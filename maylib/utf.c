@@ -3,13 +3,16 @@
 #include "mem.h"
 #include "err.h"
 #include <assert.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 ERR_DEFINE(e_utf_conversion, "Invalid UTF string or encoding.", 0);
 
 #define C_BETWEEN(p, c1, c2) (*((unsigned char *)(p))>=(c1) && *((unsigned char *)(p))<=(c2))
 #define C_OFFSET(p,s) (((unsigned char*)(p))+(s))
 #define C_LESS(p,c) (*((unsigned char *)(p))<(c))
-#define C_TO_LONG(p, offset) ((unsigned long)(*((unsigned char *)((p)+(offset)))))
 
 #define CHAR_LEN(p, enc) (((enc)==UTF_32_LE || (enc)==UTF_32_BE) ? 4 : (               \
 		((enc)==UTF_16_BE) ? (C_BETWEEN((p), 0xD8, 0xDB)?4:2) : (                      \
@@ -26,7 +29,7 @@ ERR_DEFINE(e_utf_conversion, "Invalid UTF string or encoding.", 0);
 
 #define CHAR_IS_LAST(p, enc) (							\
 	((enc)==UTF_32_LE || (enc)==UTF_32_BE) ? (			\
-		(*((long *)(p)))==0								\
+		(*((uint32_t *)(p)))==0								\
 	) : (												\
 		((enc)==UTF_16_LE || (enc)==UTF_16_BE) ? (		\
 			(*((short *)(p)))==0						\
@@ -36,137 +39,6 @@ ERR_DEFINE(e_utf_conversion, "Invalid UTF string or encoding.", 0);
 	)													\
 )
 
-#define CHAR_TO_LONG(p, enc) (((enc)==UTF_32_BE) ? (													\
-		(C_TO_LONG((p),0)<<24)|(C_TO_LONG((p),1)<<16)|(C_TO_LONG((p),2)<<8)|C_TO_LONG((p),3)			\
-	) : (																								\
-		(enc==UTF_32_LE) ? (																			\
-			(C_TO_LONG((p),3)<<24)|(C_TO_LONG((p),2)<<16)|(C_TO_LONG((p),1)<<8)|C_TO_LONG((p),0)		\
-		) : (																							\
-			(enc==UTF_16_LE) ? (																		\
-				C_BETWEEN(C_OFFSET((p),1),0xD8,0xDB) ? (												\
-					(((C_TO_LONG((p),0) | (C_TO_LONG((p),1)<<8))-0xD800)<<10)							\
-						+ ((C_TO_LONG((p),2) | (C_TO_LONG((p),3)<<8))-0xD800)							\
-						+ 0x10000																		\
-				) : (																					\
-					C_TO_LONG((p),0) | (C_TO_LONG((p),1)<<8)											\
-				)																						\
-			) : (																						\
-				(enc==UTF_16_BE) ? (																	\
-					C_BETWEEN((p),0xD8,0xDB) ? (														\
-						(((C_TO_LONG((p),1) | (C_TO_LONG((p),0)<<8))-0xD800)<<10)						\
-							+ ((C_TO_LONG((p),3) | (C_TO_LONG((p),2)<<8))-0xD800)						\
-							+ 0x10000																	\
-					) : (																				\
-						C_TO_LONG((p),1) | (C_TO_LONG((p),0)<<8)										\
-					)																					\
-				) : (																					\
-					C_LESS((p),0x80) ? C_TO_LONG((p),0) : (												\
-						C_LESS((p),0xE0) ? (															\
-							((C_TO_LONG((p),0)&0x1F)<<6) + (C_TO_LONG((p),1)&0x3F)						\
-						) : (																			\
-							C_LESS((p),0xF0) ? ( /*3*/													\
-								((C_TO_LONG((p),0)&0x0F)<<12) 											\
-									| ((C_TO_LONG((p),1)&0x3F)<<6) 										\
-									| (C_TO_LONG((p),2)&0x3F)											\
-							) : ( /*4*/																	\
-								((C_TO_LONG((p),0)&0x07)<<18) 											\
-									| ((C_TO_LONG((p),1)&0x3F)<<12)										\
-									| ((C_TO_LONG((p),2)&0x3F)<<6) 										\
-									| (C_TO_LONG((p),2)&0x3F)											\
-							)																			\
-						)																				\
-					)  																					\
-				)																						\
-			)																							\
-		)																								\
-	)																									\
-)
-
-#define UTF_WRITE1(dest, c1) ( \
-	((*C_OFFSET(dest, 0))=c1), \
-	C_OFFSET(dest, 1)          \
-)
-
-#define UTF_WRITE2(dest, c1, c2) (      \
-	((*C_OFFSET(dest, 0))=c1),          \
-	((*C_OFFSET(dest, 1))=c2),          \
-	C_OFFSET(dest, 2)                   \
-)
-
-#define UTF_WRITE3(dest, c1, c2, c3) (  \
-	((*C_OFFSET(dest, 0))=c1),		 	\
-	((*C_OFFSET(dest, 1))=c2),			\
-	((*C_OFFSET(dest, 2))=c3),			\
-	C_OFFSET(dest, 3)					\
-)
-
-#define UTF_WRITE4(dest, c1, c2, c3, c4) (		\
-	((*C_OFFSET(dest, 0))=c1), 					\
-	((*C_OFFSET(dest, 1))=c2),					\
-	((*C_OFFSET(dest, 2))=c3),					\
-	((*C_OFFSET(dest, 3))=c4),					\
-	C_OFFSET(dest, 4)							\
-)
-
-#define LONG_TO_UTF(c, dest, enc)									\
-	((enc)==UTF_32_LE) ? (											\
-		UTF_WRITE4(													\
-			(dest),													\
-			(c)&0xFF,												\
-			((c)>>8)&0xFF,											\
-			((c)>>16)&0xFF,											\
-			((c)>>24)&0xFF											\
-		)															\
-	) : (															\
-		((enc)==UTF_32_BE) ? (										\
-			UTF_WRITE4(												\
-				(dest), 											\
-				((c)>>24)&0xFF,										\
-				((c)>>16)&0xFF, 									\
-				((c)>>8)&0xFF, 										\
-				(c)&0xFF											\
-			)														\
-		) : (														\
-			((enc)==UTF_16_LE) ? (									\
-				UTF_WRITE2((dest), (c)&0xFF, ((c)>>8)&0xFF)			\
-			) : (													\
-				((enc)==UTF_16_BE) ? (								\
-					UTF_WRITE2((dest), ((c)>>8)&0xFF, (c)&0xFF)		\
-				) : (												\
-					((c)<=0x7f) ? (									\
-						UTF_WRITE1((dest), (c))						\
-					) : (											\
-						((c)<=0x07FF) ? (							\
-							UTF_WRITE2(								\
-								(dest), 							\
-								(((c)>>6)&0x1F)|0xC0, 				\
-								((c)&0x3F) | 0x80					\
-							)										\
-						) : (										\
-							((c)<=0xFFFF) ? (						\
-								UTF_WRITE3(							\
-									(dest),							\
-									(((c)>>12)&0x0F)|0xE0,			\
-									(((c)>>6)&0x3F) | 0x80,			\
-									((c)&0x3F) | 0x80				\
-								)									\
-							) : (									\
-								UTF_WRITE4(							\
-									(dest), 						\
-									(((c)>>18)&0x07)|0xF0, 			\
-									(((c)>>12)&0x3F) | 0x80, 		\
-									(((c)>>6)&0x3F) | 0x80, 		\
-									((c)&0x3F) | 0x80				\
-								)									\
-							)										\
-						)											\
-					)												\
-				)													\
-			)														\
-		)															\
-	)
-
-
 size_t utf_length(void *s, int enc) {
 	int res = 0;
 	if(!s)
@@ -189,26 +61,449 @@ define UTF_32_BE 5
 */
 
 
-void *utf_convert(heap_t h, void *src, int src_enc, int dest_enc) {
-	void *res;
-	void *i;
-	int len;
-	if(!src)
+/* bytes of input sampled by utf_detect heuristic */
+#define DETECT_SAMPLE 4096
+
+size_t utf_bom_length(void *s, size_t sz, int enc) {
+	const unsigned char *p = s;
+	switch(enc) {
+	case UTF_8:
+		return (sz>=3 && p[0]==0xEF && p[1]==0xBB && p[2]==0xBF) ? 3 : 0;
+	case UTF_16_LE:
+		return (sz>=2 && p[0]==0xFF && p[1]==0xFE) ? 2 : 0;
+	case UTF_16_BE:
+		return (sz>=2 && p[0]==0xFE && p[1]==0xFF) ? 2 : 0;
+	case UTF_32_LE:
+		return (sz>=4 && p[0]==0xFF && p[1]==0xFE && p[2]==0 && p[3]==0) ? 4 : 0;
+	case UTF_32_BE:
+		return (sz>=4 && p[0]==0 && p[1]==0 && p[2]==0xFE && p[3]==0xFF) ? 4 : 0;
+	}
+	return 0;
+}
+
+int utf_detect(void *s, size_t sz) {
+	const unsigned char *p = s;
+	size_t zeros[4] = {0, 0, 0, 0};
+	size_t i, n, quarter, valid;
+	/* UTF-32 LE first, its BOM starts with BOM of UTF-16 LE */
+	if(utf_bom_length(s, sz, UTF_32_LE))
+		return UTF_32_LE;
+	if(utf_bom_length(s, sz, UTF_32_BE))
+		return UTF_32_BE;
+	if(utf_bom_length(s, sz, UTF_8))
+		return UTF_8;
+	if(utf_bom_length(s, sz, UTF_16_LE))
+		return UTF_16_LE;
+	if(utf_bom_length(s, sz, UTF_16_BE))
+		return UTF_16_BE;
+	n = sz<DETECT_SAMPLE ? sz : DETECT_SAMPLE;
+	for(i=0; i<n; i++)
+		zeros[i & 3] += !p[i];
+	quarter = n/4;
+	if(!(zeros[0] | zeros[1] | zeros[2] | zeros[3])) {
+		/* sequence may be cut at the end of sample */
+		valid = utf_validate(s, n);
+		return (valid==n || (n<sz && n - valid<4)) ? UTF_8 : 0;
+	}
+	if(!quarter)
+		return 0;
+	/* ASCII is one non-zero byte in every code unit */
+	if(zeros[1]*2>quarter && zeros[2]*2>quarter && zeros[3]*2>quarter && zeros[0]*2<quarter)
+		return UTF_32_LE;
+	if(zeros[0]*2>quarter && zeros[1]*2>quarter && zeros[2]*2>quarter && zeros[3]*2<quarter)
+		return UTF_32_BE;
+	if(zeros[1] + zeros[3]>quarter && (zeros[0] + zeros[2])*8<zeros[1] + zeros[3])
+		return UTF_16_LE;
+	if(zeros[0] + zeros[2]>quarter && (zeros[1] + zeros[3])*8<zeros[0] + zeros[2])
+		return UTF_16_BE;
+	return 0;
+}
+
+/**
+ * Skip ASCII bytes, return pointer to first non-ASCII byte or end.
+ */
+static const unsigned char *skip_ascii(const unsigned char *p, const unsigned char *end) {
+#ifdef __SSE2__
+	while(end - p>=64) {
+		__m128i a = _mm_loadu_si128((const __m128i *)p);
+		__m128i b = _mm_loadu_si128((const __m128i *)(p + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *)(p + 32));
+		__m128i d = _mm_loadu_si128((const __m128i *)(p + 48));
+		if(_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d))))
+			break;
+		p += 64;
+	}
+	while(end - p>=16) {
+		int m = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)p));
+		if(m)
+			return p + __builtin_ctz(m);
+		p += 16;
+	}
+#else
+	while(end - p>=8) {
+		uint64_t w;
+		memcpy(&w, p, 8);
+		if(w & 0x8080808080808080ull)
+			break;
+		p += 8;
+	}
+#endif
+	while(p<end && *p<0x80)
+		p++;
+	return p;
+}
+
+/**
+ * Length of valid multibyte sequence at p, zero if it is invalid.
+ */
+static size_t utf8_sequence(const unsigned char *p, const unsigned char *end) {
+	unsigned char lo = 0x80, hi = 0xBF;
+	size_t len, i;
+	if(*p<0xC2)
 		return 0;
+	else if(*p<0xE0)
+		len = 2;
+	else if(*p<0xF0) {
+		len = 3;
+		if(*p==0xE0)
+			lo = 0xA0;
+		else if(*p==0xED)
+			hi = 0x9F;
+	} else if(*p<0xF5) {
+		len = 4;
+		if(*p==0xF0)
+			lo = 0x90;
+		else if(*p==0xF4)
+			hi = 0x8F;
+	} else
+		return 0;
+	if((size_t)(end - p)<len || p[1]<lo || p[1]>hi)
+		return 0;
+	for(i=2; i<len; i++)
+		if((p[i] & 0xC0)!=0x80)
+			return 0;
+	return len;
+}
+
+size_t utf_validate(void *s, size_t sz) {
+	const unsigned char *p = s, *end = p + sz;
+	while(p<end) {
+		p = skip_ascii(p, end);
+		while(p<end && *p>=0x80) {
+			size_t len = utf8_sequence(p, end);
+			if(!len)
+				return p - (const unsigned char *)s;
+			p += len;
+		}
+	}
+	return sz;
+}
+
+/* size of code unit */
+#define UNIT(enc) ((enc)==UTF_8 ? 1 : ((enc)==UTF_16_LE || (enc)==UTF_16_BE) ? 2 : 4)
+
+static inline uint32_t read16(int enc, const unsigned char *p) {
+	return enc==UTF_16_LE ? (uint32_t)p[0] | (uint32_t)p[1]<<8 : (uint32_t)p[0]<<8 | p[1];
+}
+
+static inline uint32_t read32(int enc, const unsigned char *p) {
+	return enc==UTF_32_LE
+		? (uint32_t)p[0] | (uint32_t)p[1]<<8 | (uint32_t)p[2]<<16 | (uint32_t)p[3]<<24
+		: (uint32_t)p[0]<<24 | (uint32_t)p[1]<<16 | (uint32_t)p[2]<<8 | p[3];
+}
+
+/**
+ * Decode one code point and move *ps after it. Returns zero for invalid
+ * or truncated input.
+ */
+static inline int decode(int enc, const unsigned char **ps, const unsigned char *end, uint32_t *c) {
+	const unsigned char *p = *ps;
+	size_t len;
+	switch(enc) {
+	case UTF_8:
+		if(*p<0x80) {
+			*c = *p;
+			*ps = p + 1;
+			return 1;
+		}
+		len = utf8_sequence(p, end);
+		if(len==2)
+			*c = (uint32_t)(p[0] & 0x1F)<<6 | (p[1] & 0x3F);
+		else if(len==3)
+			*c = (uint32_t)(p[0] & 0x0F)<<12 | (uint32_t)(p[1] & 0x3F)<<6 | (p[2] & 0x3F);
+		else if(len==4)
+			*c = (uint32_t)(p[0] & 0x07)<<18 | (uint32_t)(p[1] & 0x3F)<<12
+				| (uint32_t)(p[2] & 0x3F)<<6 | (p[3] & 0x3F);
+		else
+			return 0;
+		*ps = p + len;
+		return 1;
+	case UTF_16_LE:
+	case UTF_16_BE:
+		if(end - p<2)
+			return 0;
+		*c = read16(enc, p);
+		if(*c>=0xD800 && *c<0xE000) {
+			uint32_t lo;
+			if(*c>=0xDC00 || end - p<4)
+				return 0;
+			lo = read16(enc, p + 2);
+			if(lo<0xDC00 || lo>=0xE000)
+				return 0;
+			*c = ((*c - 0xD800)<<10) + (lo - 0xDC00) + 0x10000;
+			*ps = p + 4;
+			return 1;
+		}
+		*ps = p + 2;
+		return 1;
+	default:
+		if(end - p<4)
+			return 0;
+		*c = read32(enc, p);
+		if(*c>0x10FFFF || (*c>=0xD800 && *c<0xE000))
+			return 0;
+		*ps = p + 4;
+		return 1;
+	}
+}
+
+static inline unsigned char *write16(int enc, unsigned char *d, uint32_t u) {
+	if(enc==UTF_16_LE) {
+		d[0] = u & 0xFF;
+		d[1] = u>>8;
+	} else {
+		d[0] = u>>8;
+		d[1] = u & 0xFF;
+	}
+	return d + 2;
+}
+
+static inline unsigned char *encode(int enc, unsigned char *d, uint32_t c) {
+	switch(enc) {
+	case UTF_8:
+		if(c<0x80) {
+			*d++ = c;
+		} else if(c<0x800) {
+			*d++ = 0xC0 | c>>6;
+			*d++ = 0x80 | (c & 0x3F);
+		} else if(c<0x10000) {
+			*d++ = 0xE0 | c>>12;
+			*d++ = 0x80 | ((c>>6) & 0x3F);
+			*d++ = 0x80 | (c & 0x3F);
+		} else {
+			*d++ = 0xF0 | c>>18;
+			*d++ = 0x80 | ((c>>12) & 0x3F);
+			*d++ = 0x80 | ((c>>6) & 0x3F);
+			*d++ = 0x80 | (c & 0x3F);
+		}
+		return d;
+	case UTF_16_LE:
+	case UTF_16_BE:
+		if(c<0x10000)
+			return write16(enc, d, c);
+		c -= 0x10000;
+		d = write16(enc, d, 0xD800 + (c>>10));
+		return write16(enc, d, 0xDC00 + (c & 0x3FF));
+	case UTF_32_LE:
+		d[0] = c & 0xFF;
+		d[1] = (c>>8) & 0xFF;
+		d[2] = (c>>16) & 0xFF;
+		d[3] = c>>24;
+		return d + 4;
+	default:
+		d[0] = c>>24;
+		d[1] = (c>>16) & 0xFF;
+		d[2] = (c>>8) & 0xFF;
+		d[3] = c & 0xFF;
+		return d + 4;
+	}
+}
+
+#ifdef __SSE2__
+
+/**
+ * Load 16 characters as bytes if all of them are ASCII.
+ */
+static inline int load_ascii(int enc, const unsigned char *p, __m128i *v) {
+	const __m128i *q = (const __m128i *)p;
+	__m128i a, b, c, d, zero = _mm_setzero_si128();
+	switch(enc) {
+	case UTF_8:
+		*v = _mm_loadu_si128(q);
+		return !_mm_movemask_epi8(*v);
+	case UTF_16_LE:
+	case UTF_16_BE:
+		a = _mm_loadu_si128(q);
+		b = _mm_loadu_si128(q + 1);
+		c = _mm_and_si128(_mm_or_si128(a, b), _mm_set1_epi16(enc==UTF_16_LE ? 0xFF80 : 0x80FF));
+		if(_mm_movemask_epi8(_mm_cmpeq_epi16(c, zero))!=0xFFFF)
+			return 0;
+		if(enc==UTF_16_BE) {
+			a = _mm_srli_epi16(a, 8);
+			b = _mm_srli_epi16(b, 8);
+		}
+		*v = _mm_packus_epi16(a, b);
+		return 1;
+	default:
+		a = _mm_loadu_si128(q);
+		b = _mm_loadu_si128(q + 1);
+		c = _mm_loadu_si128(q + 2);
+		d = _mm_loadu_si128(q + 3);
+		if(_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)),
+				_mm_set1_epi32(enc==UTF_32_LE ? 0xFFFFFF80 : 0x80FFFFFF)), zero))!=0xFFFF)
+			return 0;
+		if(enc==UTF_32_BE) {
+			a = _mm_srli_epi32(a, 24);
+			b = _mm_srli_epi32(b, 24);
+			c = _mm_srli_epi32(c, 24);
+			d = _mm_srli_epi32(d, 24);
+		}
+		*v = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+		return 1;
+	}
+}
+
+static inline void store_ascii(int enc, unsigned char *p, __m128i v) {
+	__m128i *q = (__m128i *)p;
+	__m128i zero = _mm_setzero_si128(), lo, hi;
+	switch(enc) {
+	case UTF_8:
+		_mm_storeu_si128(q, v);
+		break;
+	case UTF_16_LE:
+		_mm_storeu_si128(q, _mm_unpacklo_epi8(v, zero));
+		_mm_storeu_si128(q + 1, _mm_unpackhi_epi8(v, zero));
+		break;
+	case UTF_16_BE:
+		_mm_storeu_si128(q, _mm_unpacklo_epi8(zero, v));
+		_mm_storeu_si128(q + 1, _mm_unpackhi_epi8(zero, v));
+		break;
+	default:
+		lo = _mm_unpacklo_epi8(v, zero);
+		hi = _mm_unpackhi_epi8(v, zero);
+		if(enc==UTF_32_LE) {
+			_mm_storeu_si128(q, _mm_unpacklo_epi16(lo, zero));
+			_mm_storeu_si128(q + 1, _mm_unpackhi_epi16(lo, zero));
+			_mm_storeu_si128(q + 2, _mm_unpacklo_epi16(hi, zero));
+			_mm_storeu_si128(q + 3, _mm_unpackhi_epi16(hi, zero));
+		} else {
+			_mm_storeu_si128(q, _mm_unpacklo_epi16(zero, _mm_slli_epi16(lo, 8)));
+			_mm_storeu_si128(q + 1, _mm_unpackhi_epi16(zero, _mm_slli_epi16(lo, 8)));
+			_mm_storeu_si128(q + 2, _mm_unpacklo_epi16(zero, _mm_slli_epi16(hi, 8)));
+			_mm_storeu_si128(q + 3, _mm_unpackhi_epi16(zero, _mm_slli_epi16(hi, 8)));
+		}
+	}
+}
+
+#endif
+
+/**
+ * Conversion loop. It is always inlined with constant encodings,
+ * so every pair of encodings gets its own loop without encoding checks.
+ * Returns end of output or zero for invalid input.
+ */
+static inline __attribute__((always_inline)) unsigned char *convert(int se, int de,
+		const unsigned char *s, const unsigned char *end, unsigned char *d) {
+	const unsigned char *stop;
+	uint32_t c;
+	while(s<end) {
+#ifdef __SSE2__
+		__m128i v;
+		while((size_t)(end - s)>=16*UNIT(se) && load_ascii(se, s, &v)) {
+			store_ascii(de, d, v);
+			s += 16*UNIT(se);
+			d += 16*UNIT(de);
+		}
+		if(s>=end)
+			break;
+#endif
+		/* don't retry fast path after every character of non-ASCII text */
+		stop = (size_t)(end - s)>16*UNIT(se) ? s + 16*UNIT(se) : end;
+		while(s<stop) {
+			if(!decode(se, &s, end, &c))
+				return 0;
+			d = encode(de, d, c);
+		}
+	}
+	return d;
+}
+
+#define CONVERT_CASE(se, de) case (se)*8 + (de): return convert(se, de, s, end, d);
+#define CONVERT_ROW(se) \
+	CONVERT_CASE(se, UTF_8) CONVERT_CASE(se, UTF_16_LE) CONVERT_CASE(se, UTF_16_BE) \
+	CONVERT_CASE(se, UTF_32_LE) CONVERT_CASE(se, UTF_32_BE)
+
+static unsigned char *convert_pair(int se, int de, const unsigned char *s, const unsigned char *end,
+		unsigned char *d) {
+	switch(se*8 + de) {
+	CONVERT_ROW(UTF_8)
+	CONVERT_ROW(UTF_16_LE)
+	CONVERT_ROW(UTF_16_BE)
+	CONVERT_ROW(UTF_32_LE)
+	CONVERT_ROW(UTF_32_BE)
+	}
+	return 0;
+}
+
+/**
+ * Most bytes of output for len bytes of input.
+ */
+static size_t max_size(int se, int de, size_t len) {
+	size_t units = len/UNIT(se);
+	if(de==UTF_32_LE || de==UTF_32_BE)
+		return units*4;
+	if(de!=UTF_8)
+		/* 4-byte UTF-8 and UTF-32 make one surrogate pair */
+		return se==UTF_8 ? units*2 : units*UNIT(se);
+	/* UTF-16 unit makes up to 3 bytes, pair 4 */
+	return se==UTF_8 ? units : se==UTF_32_LE || se==UTF_32_BE ? units*4 : units*3;
+}
+
+void *utf_convert_n(heap_t h, const void *src, size_t len, int src_enc, int dest_enc, size_t *dest_len) {
+	const unsigned char *s = src;
+	unsigned char *res, *end;
+	size_t sz;
+	assert(src_enc>=UTF_8 && src_enc<=UTF_32_BE && dest_enc>=UTF_8 && dest_enc<=UTF_32_BE);
 	err_reset();
-	len = utf_length(src, src_enc) + 1;
-	i = res = heap_alloc(h, len*4);
+	if(len % UNIT(src_enc)) {
+		err_set(e_utf_conversion);
+		return 0;
+	}
+	sz = max_size(src_enc, dest_enc, len) + 4;
+	res = heap_alloc(h, sz);
 	if(err())
 		return 0;
-	while(!CHAR_IS_LAST(src, src_enc)) {
-		long c = CHAR_TO_LONG(src, src_enc);
-		src = C_OFFSET(src, CHAR_LEN(src, src_enc));
-		i = LONG_TO_UTF(c, i, dest_enc);
+	if(src_enc==UTF_8 && dest_enc==UTF_8) {
+		end = utf_validate((void *)s, len)==len ? (unsigned char *)memcpy(res, s, len) + len : 0;
+	} else
+		end = convert_pair(src_enc, dest_enc, s, s + len, res);
+	if(!end) {
+		heap_shrink(h, res, sz, 0);
+		err_set(e_utf_conversion);
+		return 0;
 	}
-	i = UTF_WRITE4(i, 0, 0, 0, 0);
+	memset(end, 0, 4);
+	heap_shrink(h, res, sz, end - res + 4);
+	if(dest_len)
+		*dest_len = end - res;
 	return res;
 }
 
-int utf_detect(void *s, size_t sz) {
-	return 0;
+void *utf_convert(heap_t h, void *src, int src_enc, int dest_enc) {
+	size_t len = 0;
+	if(!src)
+		return 0;
+	switch(UNIT(src_enc)) {
+	case 1:
+		len = strlen(src);
+		break;
+	case 2:
+		while(((uint16_t *)src)[len/2])
+			len += 2;
+		break;
+	default:
+		while(((uint32_t *)src)[len/4])
+			len += 4;
+	}
+	return utf_convert_n(h, src, len, src_enc, dest_enc, 0);
 }
@@ -10,11 +10,34 @@
 #define UTF_32_LE 4
 #define UTF_32_BE 5
 
+/**
+ * Convert zero-ended string. Result is zero-ended (with zero code unit
+ * of dest_enc). Sets e_utf_conversion for invalid source.
+ */
 void *utf_convert(heap_t h, void *src, int src_enc, int dest_enc);
+/**
+ * Convert len bytes of src, which need not be zero-ended. Result is
+ * zero-ended too, its length in bytes (without zero) is set to dest_len
+ * if it is not null. ASCII runs are converted 16 characters at a time.
+ */
+void *utf_convert_n(heap_t h, const void *src, size_t len, int src_enc, int dest_enc, size_t *dest_len);
 /**
  * Return UTF_??? or zero if can't detect encoding type.
+ * Byte order mark is used if present, otherwise zero bytes of the first
+ * kilobytes are counted (text is expected to be mostly ASCII).
  */
 int utf_detect(void *, size_t);
+/**
+ * Length of byte order mark of enc at the beginning, zero if there is none.
+ */
+size_t utf_bom_length(void *, size_t, int enc);
+/**
+ * Check UTF-8 (without overlong forms, surrogates and code points
+ * above U+10FFFF). Returns length of the valid prefix, so the whole
+ * buffer is valid if it returns its size. ASCII runs are checked
+ * 64 bytes at a time.
+ */
+size_t utf_validate(void *, size_t);
 size_t utf_length(void *s, int enc);
 size_t utf_char_length(void *s, int enc);
 
@@ -0,0 +1,223 @@
+#include "binary.h"
+#include "parser.h"
+#include "io.h"
+#include <string.h>
+
+#define PAD8(sz) (((sz) + 7) & ~(size_t)7)
+
+str_t xcss_binary_name(heap_t h, str_t name) {
+	str_t r = str_create(h, str_length(name) + 1);
+	if(err())
+		return 0;
+	memcpy(str_begin(r), str_begin(name), str_length(name));
+	str_begin(r)[str_length(name)] = 'b';
+	return r;
+}
+
+void xcss_binary_write(FILE *f, str_t text, struct stat *st, syntree_t tree) {
+	static const char zeros[8] = {0};
+	xcss_binary_header_s hd;
+	xcss_binary_node_s nodes[1024];
+	syntree_node_t i;
+	size_t n = 0;
+	/* positions are 32 bit */
+	if(str_length(text)>UINT32_MAX)
+		goto error;
+	memset(&hd, 0, sizeof(hd));
+	memcpy(hd.magic, "XCSB", 4);
+	hd.version = XCSS_BINARY_VERSION;
+	hd.order = XCSS_BINARY_ORDER;
+	hd.source_size = st->st_size;
+	hd.source_sec = st->st_mtim.tv_sec;
+	hd.source_nsec = st->st_mtim.tv_nsec;
+	hd.text_size = str_length(text);
+	for(i=syntree_begin(tree); i; i=i->next)
+		hd.node_count++;
+	if(fwrite(&hd, sizeof(hd), 1, f)!=1
+	   || fwrite(str_begin(text), 1, str_length(text), f)!=str_length(text)
+	   || fwrite(zeros, 1, PAD8(str_length(text)) - str_length(text), f)!=PAD8(str_length(text)) - str_length(text))
+		goto error;
+	for(i=syntree_begin(tree); i; i=i->next) {
+		nodes[n].position = i->position - str_begin(text);
+		nodes[n].name = i->is_start ? XCSS_BINARY_START | i->name : 0;
+		if(++n==sizeof(nodes)/sizeof(nodes[0]) || !i->next) {
+			if(fwrite(nodes, sizeof(nodes[0]), n, f)!=n)
+				goto error;
+			n = 0;
+		}
+	}
+	return;
+error:
+	err_set(e_xcss_io);
+}
+
+/**
+ * Nodes must be balanced, in order and inside of text, so the tree
+ * can be walked as a parsed one.
+ */
+static int nodes_valid(const xcss_binary_node_s *nd, size_t count, size_t text_size) {
+	size_t i, depth = 0;
+	uint32_t prev = 0;
+	for(i=0; i<count; i++) {
+		if(nd[i].position<prev || nd[i].position>text_size)
+			return 0;
+		prev = nd[i].position;
+		if(nd[i].name & XCSS_BINARY_START) {
+			uint32_t nm = nd[i].name & ~XCSS_BINARY_START;
+			if(nm<XCSS_NODE_NAME || nm>XCSS_NODE_BODY)
+				return 0;
+			depth++;
+		} else {
+			if(nd[i].name || !depth)
+				return 0;
+			depth--;
+		}
+	}
+	return !depth;
+}
+
+static int is_statement(uint32_t nm) {
+	return nm==XCSS_NODE_RULE || nm==XCSS_NODE_NAMESPACE || nm==XCSS_NODE_CLASS
+		|| nm==XCSS_NODE_COMMENT || nm==XCSS_NODE_INCLUDE;
+}
+
+/**
+ * Node nm may be child number n of parent (zero for top level), after
+ * child prev.
+ */
+static int child_valid(uint32_t parent, size_t n, uint32_t prev, uint32_t nm) {
+	switch(parent) {
+		case 0:
+			return is_statement(nm);
+		case XCSS_NODE_NAMESPACE:
+			return n ? is_statement(nm) : nm==XCSS_NODE_NAME;
+		case XCSS_NODE_RULE:
+			return n==0 ? nm==XCSS_NODE_NAME : n==1 && nm==XCSS_NODE_VALUE;
+		case XCSS_NODE_CLASS:
+			if(n==0)
+				return nm==XCSS_NODE_CLASS_NAME;
+			if(prev==XCSS_NODE_CLASS_NAME)
+				return nm==XCSS_NODE_CLASS_PARENT || nm==XCSS_NODE_BODY;
+			return prev==XCSS_NODE_CLASS_PARENT && nm==XCSS_NODE_BODY;
+		case XCSS_NODE_CLASS_PARENT:
+			return nm==XCSS_NODE_CLASS_NAME;
+		case XCSS_NODE_INCLUDE:
+			return !n && nm==XCSS_NODE_INCLUDE_NAME;
+		case XCSS_NODE_VALUE:
+			return nm==XCSS_NODE_TEXT || nm==XCSS_NODE_NAME || nm==XCSS_NODE_CALC;
+		case XCSS_NODE_CALC:
+			return nm==XCSS_NODE_TEXT || nm==XCSS_NODE_NAME;
+		default:
+			/* names, text and unparsed body */
+			return 0;
+	}
+}
+
+static int children_complete(uint32_t parent, size_t n, uint32_t prev) {
+	switch(parent) {
+		case XCSS_NODE_NAMESPACE:
+		case XCSS_NODE_CLASS_PARENT:
+		case XCSS_NODE_INCLUDE:
+			return n>=1;
+		case XCSS_NODE_RULE:
+			return n==2;
+		case XCSS_NODE_CLASS:
+			return prev==XCSS_NODE_BODY;
+		default:
+			return 1;
+	}
+}
+
+/**
+ * Children of parent starting at *i (and end of parent) must have the
+ * shapes parser gives them, evaluation relies on it. Nodes are balanced.
+ */
+static int shape_valid(const xcss_binary_node_s *nd, size_t count, size_t *i, uint32_t parent) {
+	size_t n = 0;
+	uint32_t prev = 0;
+	while(*i<count && nd[*i].name) {
+		uint32_t nm = nd[*i].name & ~XCSS_BINARY_START;
+		if(!child_valid(parent, n, prev, nm))
+			return 0;
+		++*i;
+		if(!shape_valid(nd, count, i, nm))
+			return 0;
+		prev = nm;
+		n++;
+	}
+	if(!children_complete(parent, n, prev))
+		return 0;
+	if(parent)
+		++*i;
+	return 1;
+}
+
+syntree_t xcss_binary_load(heap_t h, str_t name, int copy, str_t *text) {
+	str_t bname, data;
+	struct stat sst, bst;
+	const xcss_binary_header_s *hd;
+	const xcss_binary_node_s *nd;
+	syntree_node_t nodes;
+	syntree_t r;
+	char *b;
+	size_t i, nodes_offset;
+	bname = xcss_binary_name(h, name);
+	if(err())
+		return 0;
+	/* source is zero-ended in the name of precompiled file */
+	str_begin(bname)[str_length(name)] = 0;
+	if(stat(str_begin(bname), &sst)!=0) {
+		str_begin(bname)[str_length(name)] = 'b';
+		return 0;
+	}
+	str_begin(bname)[str_length(name)] = 'b';
+	if(stat(str_begin(bname), &bst)!=0 || !S_ISREG(bst.st_mode) || bst.st_size<(off_t)sizeof(xcss_binary_header_s))
+		return 0;
+	data = copy ? xcss_copy_file(h, bname) : xcss_read_file(h, bname);
+	if(err()) {
+		err_clear();
+		return 0;
+	}
+	b = str_begin(data);
+	hd = (const xcss_binary_header_s *)b;
+	if(str_length(data)<sizeof(*hd) || memcmp(hd->magic, "XCSB", 4)
+	   || hd->version!=XCSS_BINARY_VERSION || hd->order!=XCSS_BINARY_ORDER)
+		return 0;
+	if(hd->source_size!=(uint64_t)sst.st_size || hd->source_sec!=sst.st_mtim.tv_sec
+	   || hd->source_nsec!=sst.st_mtim.tv_nsec)
+		return 0;
+	nodes_offset = sizeof(*hd) + PAD8(hd->text_size);
+	if(hd->text_size>UINT32_MAX || nodes_offset>str_length(data)
+	   || hd->node_count!=(str_length(data) - nodes_offset)/sizeof(xcss_binary_node_s)
+	   || (str_length(data) - nodes_offset)%sizeof(xcss_binary_node_s))
+		return 0;
+	nd = (const xcss_binary_node_s *)(b + nodes_offset);
+	i = 0;
+	if(!nodes_valid(nd, hd->node_count, hd->text_size) || !shape_valid(nd, hd->node_count, &i, 0))
+		return 0;
+	*text = str_interval(h, b + sizeof(*hd), b + sizeof(*hd) + hd->text_size);
+	if(err())
+		return 0;
+	r = syntree_create(h, *text);
+	if(err())
+		return 0;
+	if(!hd->node_count)
+		return r;
+	/* walking the tree follows links, so nodes are made in one array */
+	nodes = heap_alloc(h, hd->node_count*sizeof(struct syntree_node_s));
+	if(err())
+		return 0;
+	for(i=0; i<hd->node_count; i++) {
+		nodes[i].is_start = (nd[i].name & XCSS_BINARY_START)!=0;
+		nodes[i].name = nd[i].name & ~XCSS_BINARY_START;
+		nodes[i].position = str_begin(*text) + nd[i].position;
+		nodes[i].heap = h;
+		nodes[i].value = 0;
+		nodes[i].next = nodes + i + 1;
+	}
+	nodes[hd->node_count - 1].next = 0;
+	r->first = nodes;
+	r->last = nodes + hd->node_count - 1;
+	syntree_seek(r, str_end(*text));
+	return r;
+}
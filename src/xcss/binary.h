@@ -0,0 +1,57 @@
+#ifndef MAY_BINARY_H
+#define MAY_BINARY_H
+
+#include "maylib/err.h"
+#include "maylib/heap.h"
+#include "maylib/str.h"
+#include "syntree.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/* changed with the format and with node names */
+#define XCSS_BINARY_VERSION 1
+#define XCSS_BINARY_ORDER 0x01020304
+
+/**
+ * Precompiled file (.xcssb next to source): header, decoded source text
+ * padded to 8 bytes and nodes. Numbers are in byte order of the machine
+ * that wrote it, files of other machines are ignored.
+ */
+typedef struct {
+	char magic[4];              /* "XCSB" */
+	uint32_t version;
+	uint32_t order;             /* XCSS_BINARY_ORDER */
+	uint32_t reserved;
+	uint64_t source_size;       /* size and mtime of source when written */
+	int64_t source_sec;
+	int64_t source_nsec;
+	uint64_t text_size;
+	uint64_t node_count;
+} xcss_binary_header_s;
+
+typedef struct {
+	uint32_t position;          /* offset in text */
+	uint32_t name;              /* node name, XCSS_BINARY_START is set for start nodes */
+} xcss_binary_node_s;
+
+#define XCSS_BINARY_START 0x80000000u
+
+/**
+ * Write syntree of source text. Stat is of the source file, it makes
+ * precompiled file stale when source changes.
+ */
+void xcss_binary_write(FILE *, str_t text, struct stat *, syntree_t);
+/**
+ * Load precompiled file of source name, if it is fresh. Text is mapped
+ * (or copied, see xcss_copy_file) and nodes are only copied to the heap,
+ * nothing is parsed.
+ * Returns zero without error if there is no fresh valid file.
+ */
+syntree_t xcss_binary_load(heap_t, str_t name, int copy, str_t *text);
+/**
+ * Name of precompiled file of source, zero-ended.
+ */
+str_t xcss_binary_name(heap_t, str_t name);
+
+#endif /* MAY_BINARY_H */
@@ -0,0 +1,187 @@
+#include "cache.h"
+#include "parser.h"
+#include "io.h"
+#include "binary.h"
+#include "maylib/mem.h"
+#include <limits.h>
+#include <string.h>
+
+xcss_cache_t xcss_cache_create(heap_t h, int check_mtime) {
+	xcss_cache_t r = heap_alloc(h, sizeof(xcss_cache_s));
+	if(err())
+		return 0;
+	r->heap = h;
+	r->check_mtime = check_mtime;
+	r->files = map_create(h);
+	if(err())
+		return 0;
+	pthread_mutex_init(&r->lock, 0);
+	return r;
+}
+
+static void file_unref(xcss_file_t f) {
+	if(f && !--f->refs) {
+		heap_delete(f->heap);
+		mem_free(f);
+	}
+}
+
+xcss_cache_t xcss_cache_delete(xcss_cache_t c) {
+	if(c) {
+		map_node_t i;
+		for(i=map_begin(c->files); i; i=map_next(i))
+			file_unref(i->value);
+		pthread_mutex_destroy(&c->lock);
+	}
+	return 0;
+}
+
+static int file_stat(str_t name, struct stat *st) {
+	char path[PATH_MAX];
+	/* names are often intervals of source, so they are not zero-ended */
+	if(str_length(name)>=PATH_MAX)
+		return 0;
+	memcpy(path, str_begin(name), str_length(name));
+	path[str_length(name)] = 0;
+	return stat(path, st)==0;
+}
+
+static int file_fresh(xcss_file_t f, struct stat *st) {
+	return f->size==st->st_size
+		&& f->mtime.tv_sec==st->st_mtim.tv_sec
+		&& f->mtime.tv_nsec==st->st_mtim.tv_nsec;
+}
+
+static xcss_file_t file_load(str_t name, struct stat *st) {
+	syntree_node_t i;
+	xcss_file_t f = mem_alloc(sizeof(xcss_file_s));
+	if(err())
+		return 0;
+	f->refs = 1;
+	f->name = name;
+	f->syntree = 0;
+	f->size = st ? st->st_size : 0;
+	f->mtime.tv_sec = st ? st->st_mtim.tv_sec : 0;
+	f->mtime.tv_nsec = st ? st->st_mtim.tv_nsec : 0;
+	f->heap = heap_create(0);
+	if(err())
+		goto error;
+	f->error = 0;
+	/* cached files live long and may be changed meanwhile, so they are copied */
+	f->syntree = xcss_binary_load(f->heap, name, 1, &f->content);
+	if(err())
+		goto error;
+	if(!f->syntree) {
+		f->content = xcss_copy_file(f->heap, name);
+		if(err())
+			goto error;
+		f->content = xcss_decode(f->heap, f->content);
+		if(err())
+			goto error;
+		f->syntree = xcss_to_syntree_ex(f->heap, f->content, &f->error);
+		if(err_get()==e_xcss_syntax) {
+			err_clear();
+			return f;
+		}
+		if(err())
+			goto error;
+	}
+	/* tree is shared between threads, so fill lazy values now, and hashes
+	   of leaves (names are looked up in maps) */
+	for(i=syntree_begin(f->syntree); i; i=i->next) {
+		if(i->is_start && syntree_name(i)!=XCSS_NODE_BODY) {
+			str_t v = syntree_value(i);
+			if(v && !syntree_child(i))
+				str_hash(v);
+		}
+	}
+	return f;
+error:
+	heap_delete(f->heap);
+	mem_free(f);
+	return 0;
+}
+
+xcss_file_t xcss_cache_get(xcss_cache_t c, str_t name) {
+	struct stat st;
+	int has_stat = 0;
+	str_t key;
+	xcss_file_t f, nf;
+	if(c->check_mtime)
+		has_stat = file_stat(name, &st);
+	pthread_mutex_lock(&c->lock);
+	f = map_get(c->files, name);
+	if(f && c->check_mtime && !has_stat) {
+		/* deleted file, it is loaded again to fail with I/O error */
+		map_set(c->files, f->name, 0);
+		file_unref(f);
+		f = 0;
+	}
+	if(f && (!has_stat || file_fresh(f, &st))) {
+		f->refs++;
+		pthread_mutex_unlock(&c->lock);
+		return f;
+	}
+	key = f ? f->name : 0;
+	pthread_mutex_unlock(&c->lock);
+	/* parse without lock, concurrent loads of the same file are harmless */
+	nf = file_load(key ? key : name, has_stat ? &st : 0);
+	if(err())
+		return 0;
+	pthread_mutex_lock(&c->lock);
+	f = map_get(c->files, name);
+	if(!f) {
+		key = str_clone(c->heap, name);
+		if(err()) {
+			pthread_mutex_unlock(&c->lock);
+			file_unref(nf);
+			return 0;
+		}
+	} else
+		key = f->name;
+	nf->name = key;
+	map_set(c->files, key, nf);
+	file_unref(f);
+	nf->refs++;
+	pthread_mutex_unlock(&c->lock);
+	return nf;
+}
+
+void xcss_cache_release(xcss_cache_t c, xcss_file_t f) {
+	pthread_mutex_lock(&c->lock);
+	file_unref(f);
+	pthread_mutex_unlock(&c->lock);
+}
+
+heap_stat_t xcss_cache_stat(xcss_cache_t c, size_t *files) {
+	heap_stat_t r;
+	map_node_t i;
+	memset(&r, 0, sizeof(r));
+	*files = 0;
+	pthread_mutex_lock(&c->lock);
+	for(i=map_begin(c->files); i; i=map_next(i)) {
+		xcss_file_t f = i->value;
+		heap_stat_t hs;
+		if(!f)
+			continue;
+		hs = heap_stat(f->heap);
+		r.used += hs.used;
+		r.reserved += hs.reserved;
+		r.blocks += hs.blocks;
+		r.large_blocks += hs.large_blocks;
+		++*files;
+	}
+	pthread_mutex_unlock(&c->lock);
+	return r;
+}
+
+void xcss_cache_invalidate(xcss_cache_t c, str_t name) {
+	xcss_file_t f;
+	pthread_mutex_lock(&c->lock);
+	f = map_get(c->files, name);
+	if(f) {
+		map_set(c->files, f->name, 0);
+		file_unref(f);
+	}
+	pthread_mutex_unlock(&c->lock);
+}
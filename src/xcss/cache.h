@@ -0,0 +1,56 @@
+#ifndef MAY_CACHE_H
+#define MAY_CACHE_H
+
+#include "maylib/err.h"
+#include "maylib/heap.h"
+#include "maylib/str.h"
+#include "maylib/map.h"
+#include "syntree.h"
+#include <pthread.h>
+#include <sys/stat.h>
+
+typedef struct xcss_file_ss {
+	str_t name;
+	heap_t heap;
+	str_t content;
+	syntree_t syntree;    /* zero if file has syntax error */
+	str_it_t error;       /* position of syntax error */
+	struct timespec mtime;
+	off_t size;
+	int refs;
+} xcss_file_s;
+
+typedef xcss_file_s *xcss_file_t;
+
+typedef struct xcss_cache_ss {
+	heap_t heap;
+	map_t files;
+	int check_mtime;
+	pthread_mutex_t lock;
+} xcss_cache_s;
+
+typedef xcss_cache_s *xcss_cache_t;
+
+/**
+ * Parsed files by name, shared between threads.
+ * Cached syntrees are read only: all node values are computed on load.
+ * Each file version owns a heap and lives while it is referenced, so
+ * replacing a file never touches trees used by running compilations.
+ */
+xcss_cache_t xcss_cache_create(heap_t, int check_mtime);
+xcss_cache_t xcss_cache_delete(xcss_cache_t);
+/**
+ * Return referenced file, reading and parsing it if it is not cached
+ * or (with check_mtime) if it was modified or removed. Files with syntax
+ * errors are cached too, without syntree.
+ */
+xcss_file_t xcss_cache_get(xcss_cache_t, str_t name);
+void xcss_cache_release(xcss_cache_t, xcss_file_t);
+void xcss_cache_invalidate(xcss_cache_t, str_t name);
+/**
+ * Memory of heaps of cached files (sum of heap_stat), number of files
+ * is stored to *files.
+ */
+heap_stat_t xcss_cache_stat(xcss_cache_t, size_t *files);
+
+#endif /* MAY_CACHE_H */
@@ -0,0 +1,277 @@
+#include "calc.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+
+/* longest number printed by "%.10g" with sign and exponent */
+#define CALC_NUMBER_SIZE 24
+
+typedef struct calc_node_ss {
+	char op;          /* 0 for number */
+	double value;
+	const char *text; /* number as written, zero if it was computed */
+	size_t text_len;
+	const char *unit;
+	size_t unit_len;
+	struct calc_node_ss *l, *r;
+} calc_node_s;
+
+typedef calc_node_s *calc_node_t;
+
+typedef struct {
+	heap_t heap;
+	const char *i;
+	const char *e;
+	size_t size;      /* upper bound of printed expression */
+} calc_parser_s;
+
+static calc_node_t parse_sum(calc_parser_s *p);
+
+static void skip_spaces(calc_parser_s *p) {
+	while(p->i<p->e && isspace((unsigned char)*p->i))
+		p->i++;
+}
+
+static calc_node_t node(calc_parser_s *p, char op) {
+	calc_node_t n = heap_alloc(p->heap, sizeof(calc_node_s));
+	if(err())
+		return 0;
+	n->op = op;
+	n->value = 0;
+	n->text = 0;
+	n->text_len = 0;
+	n->unit = 0;
+	n->unit_len = 0;
+	n->l = n->r = 0;
+	p->size += CALC_NUMBER_SIZE + 4;
+	return n;
+}
+
+static calc_node_t parse_number(calc_parser_s *p) {
+	char buf[CALC_NUMBER_SIZE*2];
+	const char *j = p->i;
+	char *end;
+	size_t len;
+	calc_node_t n;
+	if(j<p->e && (*j=='+' || *j=='-'))
+		j++;
+	while(j<p->e && (isdigit((unsigned char)*j) || *j=='.'))
+		j++;
+	if(j<p->e && (*j=='e' || *j=='E') && j+1<p->e && (isdigit((unsigned char)j[1])
+			|| ((j[1]=='+' || j[1]=='-') && j+2<p->e && isdigit((unsigned char)j[2]))))
+		for(j+=2; j<p->e && isdigit((unsigned char)*j); j++);
+	len = j - p->i;
+	if(!len || len>=sizeof(buf))
+		return 0;
+	/* source is not zero-ended */
+	memcpy(buf, p->i, len);
+	buf[len] = 0;
+	n = node(p, 0);
+	if(!n)
+		return 0;
+	n->value = strtod(buf, &end);
+	if(end!=buf + len)
+		return 0;
+	n->text = p->i;
+	n->text_len = len;
+	p->size += len;
+	p->i = n->unit = j;
+	while(p->i<p->e && (isalpha((unsigned char)*p->i) || *p->i=='%'))
+		p->i++;
+	n->unit_len = p->i - n->unit;
+	p->size += n->unit_len;
+	return n;
+}
+
+static calc_node_t parse_factor(calc_parser_s *p) {
+	calc_node_t n;
+	skip_spaces(p);
+	if(p->i==p->e)
+		return 0;
+	if(*p->i=='(' || ((p->e - p->i)>=5 && !memcmp(p->i, "calc(", 5))) {
+		p->i += *p->i=='(' ? 1 : 5;
+		n = parse_sum(p);
+		if(!n)
+			return 0;
+		skip_spaces(p);
+		if(p->i==p->e || *p->i!=')')
+			return 0;
+		p->i++;
+		return n;
+	}
+	return parse_number(p);
+}
+
+static calc_node_t binary(calc_parser_s *p, char op, calc_node_t l, calc_node_t r) {
+	calc_node_t n;
+	if(!r)
+		return 0;
+	n = node(p, op);
+	if(n) {
+		n->l = l;
+		n->r = r;
+	}
+	return n;
+}
+
+static calc_node_t parse_product(calc_parser_s *p) {
+	calc_node_t n = parse_factor(p);
+	while(n) {
+		char op;
+		skip_spaces(p);
+		if(p->i==p->e || (*p->i!='*' && *p->i!='/'))
+			break;
+		op = *p->i++;
+		n = binary(p, op, n, parse_factor(p));
+	}
+	return n;
+}
+
+static calc_node_t parse_sum(calc_parser_s *p) {
+	calc_node_t n = parse_product(p);
+	while(n) {
+		char op;
+		skip_spaces(p);
+		if(p->i==p->e || (*p->i!='+' && *p->i!='-'))
+			break;
+		/* CSS needs spaces around + and -, otherwise it's a sign */
+		if(p->i+1==p->e || !isspace((unsigned char)p->i[1]))
+			return 0;
+		op = *p->i++;
+		n = binary(p, op, n, parse_product(p));
+	}
+	return n;
+}
+
+static int same_unit(calc_node_t a, calc_node_t b) {
+	return a->unit_len==b->unit_len && !strncasecmp(a->unit, b->unit, a->unit_len);
+}
+
+/**
+ * Fold subtrees with numbers on both sides, if their units combine.
+ */
+static void fold(calc_node_t n) {
+	calc_node_t l = n->l, r = n->r;
+	if(!n->op)
+		return;
+	fold(l);
+	fold(r);
+	if((n->op=='+' || n->op=='-') && (l->op=='+' || l->op=='-') && !l->r->op && !r->op
+			&& same_unit(l->r, r)) {
+		/* (a - 8px) - 8px gives a - 16px */
+		double v = (l->op=='+' ? l->r->value : -l->r->value) + (n->op=='+' ? r->value : -r->value);
+		n->op = v<0 ? '-' : '+';
+		r->value = v<0 ? -v : v;
+		r->text = 0;
+		r->unit = l->r->unit;
+		r->unit_len = l->r->unit_len;
+		n->l = l->l;
+		return;
+	}
+	if(l->op || r->op)
+		return;
+	switch(n->op) {
+		case '+':
+		case '-':
+			if(!same_unit(l, r))
+				return;
+			n->value = n->op=='+' ? l->value + r->value : l->value - r->value;
+			n->unit = l->unit;
+			n->unit_len = l->unit_len;
+			break;
+		case '*':
+			if(l->unit_len && r->unit_len)
+				return;
+			n->value = l->value*r->value;
+			n->unit = l->unit_len ? l->unit : r->unit;
+			n->unit_len = l->unit_len ? l->unit_len : r->unit_len;
+			break;
+		case '/':
+			if(r->unit_len || r->value==0)
+				return;
+			n->value = l->value/r->value;
+			n->unit = l->unit;
+			n->unit_len = l->unit_len;
+			break;
+	}
+	n->op = 0;
+	n->text = 0;
+}
+
+static int priority(calc_node_t n) {
+	return !n->op ? 3 : (n->op=='*' || n->op=='/') ? 2 : 1;
+}
+
+static char *print(char *o, calc_node_t n) {
+	int pl, pr;
+	if(!n->op) {
+		double v = n->value==0 ? 0 : n->value;   /* no "-0" */
+		/* numbers left as they are keep their precision */
+		if(n->text) {
+			memcpy(o, n->text, n->text_len);
+			o += n->text_len;
+		} else
+			o += snprintf(o, CALC_NUMBER_SIZE, "%.10g", v);
+		memcpy(o, n->unit, n->unit_len);
+		return o + n->unit_len;
+	}
+	pl = priority(n->l) < priority(n);
+	/* right operand of - and / keeps parentheses of same priority */
+	pr = priority(n->r) < priority(n) + (n->op=='-' || n->op=='/');
+	if(pl)
+		*o++ = '(';
+	o = print(o, n->l);
+	if(pl)
+		*o++ = ')';
+	*o++ = ' ';
+	*o++ = n->op;
+	*o++ = ' ';
+	if(pr)
+		*o++ = '(';
+	o = print(o, n->r);
+	if(pr)
+		*o++ = ')';
+	return o;
+}
+
+static str_t keep(heap_t h, str_t expr) {
+	str_t r = str_create(h, str_length(expr) + 6);
+	if(err())
+		return 0;
+	memcpy(str_begin(r), "calc(", 5);
+	memcpy(str_begin(r) + 5, str_begin(expr), str_length(expr));
+	str_begin(r)[str_length(r) - 1] = ')';
+	return r;
+}
+
+str_t xcss_calc(heap_t h, str_t expr) {
+	calc_parser_s p;
+	calc_node_t n;
+	str_t r;
+	char *o;
+	p.heap = h;
+	p.i = str_begin(expr);
+	p.e = str_end(expr);
+	p.size = 0;
+	n = parse_sum(&p);
+	if(err())
+		return 0;
+	skip_spaces(&p);
+	if(!n || p.i!=p.e)
+		return keep(h, expr);
+	fold(n);
+	r = str_create(h, p.size + 6);
+	if(err())
+		return 0;
+	o = str_begin(r);
+	if(n->op) {
+		memcpy(o, "calc(", 5);
+		o = print(o + 5, n);
+		*o++ = ')';
+	} else
+		o = print(o, n);
+	*o = 0;
+	r->length = o - str_begin(r);
+	return r;
+}
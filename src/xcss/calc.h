@@ -0,0 +1,18 @@
+#ifndef MAY_CALC_H
+#define MAY_CALC_H
+
+#include "maylib/err.h"
+#include "maylib/heap.h"
+#include "maylib/str.h"
+
+/**
+ * Fold calc() expression (text inside parentheses, variables substituted)
+ * at compile time. Numbers with units are combined by + - * / when CSS
+ * allows it, so "100% - 8px * 2" gives "calc(100% - 16px)" and "8px * 2"
+ * gives "16px". Numbers which are not combined are kept as written.
+ * Expressions which can't be parsed (var(), min() and so on) are returned
+ * as "calc(expr)" unchanged.
+ */
+str_t xcss_calc(heap_t, str_t expr);
+
+#endif /* MAY_CALC_H */
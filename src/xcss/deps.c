@@ -0,0 +1,169 @@
+#include "deps.h"
+#include "io.h"
+#include "maylib/map.h"
+#include <ctype.h>
+#include <string.h>
+
+static const char scan_stop[256] = {
+	['"'] = 1,
+	['\''] = 1,
+	['/'] = 1,
+	['{'] = 1,
+	['}'] = 1
+};
+
+str_t xcss_include_path(heap_t h, str_t fprefix, str_t name, str_t *prefix) {
+	str_it_t si;
+	if(fprefix) {
+		name = str_cat(h, fprefix, name);
+		if(err())
+			return 0;
+	}
+	*prefix = fprefix;
+	for(si=str_end(name)-1; si>str_begin(name); si--) {
+		if(*si=='/') {
+			*prefix = str_interval(h, str_begin(name), si+1);
+			if(err())
+				return 0;
+			break;
+		}
+	}
+	return name;
+}
+
+/**
+ * Closing quote of quote at i. Like in the parser, strings don't span
+ * lines or blocks, so zero is returned for a stray quote (an apostrophe
+ * in value) and it is taken as text.
+ */
+static str_it_t quote_end(str_it_t i, str_it_t e) {
+	str_it_t j;
+	for(j=i+1; j<e; j++) {
+		if(*j==*i)
+			return j;
+		if(*j=='\n' || *j=='{' || *j=='}')
+			return 0;
+	}
+	return 0;
+}
+
+static int is_include(str_it_t b, str_it_t i) {
+	static const char include_str[] = "include";
+	size_t len = sizeof(include_str) - 1;
+	while(i>b && isspace(i[-1]))
+		i--;
+	if(i==b || *--i!='(')
+		return 0;
+	while(i>b && isspace(i[-1]))
+		i--;
+	if((size_t)(i-b)<len || memcmp(i-len, include_str, len))
+		return 0;
+	i -= len;
+	return i==b || !(isalnum(i[-1]) || i[-1]=='_' || i[-1]=='-');
+}
+
+void xcss_scan_includes(heap_t h, str_t src, xcss_include_f f, void *data) {
+	str_it_t b = str_begin(src);
+	str_it_t i = b;
+	str_it_t e = str_end(src);
+	int depth = 0;
+	while(i<e) {
+		str_it_t j;
+		while(i<e && !scan_stop[(unsigned char)*i])
+			i++;
+		if(i==e)
+			break;
+		switch(*i) {
+			case '/':
+				if((e-i)<2 || i[1]!='*') {
+					i++;
+					break;
+				}
+				for(j=i+2; (j = memchr(j, '*', e-j)); j++)
+					if((e-j)>=2 && j[1]=='/')
+						break;
+				i = j ? j+2 : e;
+				break;
+			case '{':
+				depth++;
+				i++;
+				break;
+			case '}':
+				if(depth)
+					depth--;
+				i++;
+				break;
+			default:
+				j = quote_end(i, e);
+				if(!j) {
+					i++;
+					break;
+				}
+				if(!depth && *i=='"' && is_include(b, i)) {
+					f(data, str_interval(h, i+1, j));
+					if(err())
+						return;
+				}
+				i = j+1;
+		}
+	}
+}
+
+typedef struct {
+	heap_t heap;
+	map_t seen;
+	FILE *sout;
+	FILE *serr;
+	int failed;               /* some file couldn't be read */
+} list_state_s;
+
+typedef struct {
+	list_state_s *state;
+	str_t prefix;
+} list_file_s;
+
+static void list_include(void *data, str_t name) {
+	list_file_s *lf = data;
+	list_state_s *ls = lf->state;
+	list_file_s child;
+	str_t fname, cnt;
+	fname = xcss_include_path(ls->heap, lf->prefix, name, &child.prefix);
+	if(err())
+		return;
+	if(map_get(ls->seen, fname))
+		return;
+	map_set(ls->seen, fname, fname);
+	fwrite(str_begin(fname), str_length(fname), 1, ls->sout);
+	fprintf(ls->sout, "\n");
+	cnt = xcss_read_file(ls->heap, fname);
+	if(!err())
+		cnt = xcss_decode(ls->heap, cnt);
+	if(err()) {
+		/* the rest is listed, error is set at the end */
+		err_clear();
+		ls->failed = 1;
+		fprintf(ls->serr, "Can't read file \"");
+		fwrite(str_begin(fname), str_length(fname), 1, ls->serr);
+		fprintf(ls->serr, "\".\n");
+		return;
+	}
+	child.state = ls;
+	xcss_scan_includes(ls->heap, cnt, list_include, &child);
+}
+
+void xcss_list_includes(heap_t h, str_t fprefix, str_t src, FILE *sout, FILE *serr) {
+	list_state_s ls;
+	list_file_s lf;
+	ls.heap = h;
+	ls.seen = map_create(h);
+	if(err())
+		return;
+	ls.sout = sout;
+	ls.serr = serr;
+	ls.failed = 0;
+	lf.state = &ls;
+	lf.prefix = fprefix;
+	xcss_scan_includes(h, src, list_include, &lf);
+	if(!err() && ls.failed)
+		err_set(e_xcss_io);
+}
@@ -0,0 +1,28 @@
+#ifndef MAY_DEPS_H
+#define MAY_DEPS_H
+
+#include "maylib/err.h"
+#include "maylib/heap.h"
+#include "maylib/str.h"
+#include <stdio.h>
+
+typedef void (*xcss_include_f)(void *, str_t);
+
+/**
+ * Resolve include name against prefix of the including file.
+ * Prefix for includes of resolved file is stored to *prefix.
+ */
+str_t xcss_include_path(heap_t, str_t fprefix, str_t name, str_t *prefix);
+/**
+ * Call function for each include("...") directive of source.
+ * Comments, strings and class bodies are skipped without building syntree.
+ */
+void xcss_scan_includes(heap_t, str_t, xcss_include_f, void *);
+/**
+ * Write each file included by source (recursively) once, one per line.
+ * Files which can't be read are reported to serr, then e_xcss_io is set
+ * when the rest is listed.
+ */
+void xcss_list_includes(heap_t, str_t fprefix, str_t, FILE *sout, FILE *serr);
+
+#endif /* MAY_DEPS_H */
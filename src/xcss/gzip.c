@@ -0,0 +1,279 @@
+#include "gzip.h"
+#include "io.h"
+#include "maylib/mem.h"
+#include <string.h>
+
+/* raw deflate with sync flush, see compressBound */
+#define BLOCK_OUT_SIZE (XCSS_GZIP_BLOCK_SIZE + (XCSS_GZIP_BLOCK_SIZE>>12) + (XCSS_GZIP_BLOCK_SIZE>>14) + 64)
+
+static void file_write(xcss_gzip_t g, const void *data, size_t sz) {
+	if(sz && fwrite(data, 1, sz, g->f)!=sz)
+		g->error = 1;
+}
+
+static void serial_deflate(xcss_gzip_t g, int flush) {
+	do {
+		g->zs.next_out = g->out;
+		g->zs.avail_out = XCSS_GZIP_OUT_SIZE;
+		if(deflate(&g->zs, flush)==Z_STREAM_ERROR) {
+			g->error = 1;
+			return;
+		}
+		file_write(g, g->out, XCSS_GZIP_OUT_SIZE - g->zs.avail_out);
+	} while(!g->zs.avail_out);
+}
+
+static void block_deflate(xcss_gzip_block_s *b, z_stream *zs) {
+	unsigned char *in = (unsigned char *)b->in + XCSS_GZIP_WINDOW;
+	int r;
+	if(!zs || deflateReset(zs)!=Z_OK) {
+		b->error = 1;
+		return;
+	}
+	if(b->dict_size)
+		deflateSetDictionary(zs, in - b->dict_size, b->dict_size);
+	zs->next_in = in;
+	zs->avail_in = b->in_used;
+	zs->next_out = b->out;
+	zs->avail_out = b->out_size;
+	/* sync flush ends block on byte boundary, so blocks may be joined */
+	r = deflate(zs, b->last ? Z_FINISH : Z_SYNC_FLUSH);
+	if(r!=(b->last ? Z_STREAM_END : Z_OK) || zs->avail_in)
+		b->error = 1;
+	b->out_used = b->out_size - zs->avail_out;
+	b->crc = crc32(crc32(0, 0, 0), in, b->in_used);
+}
+
+static void *worker(void *data) {
+	xcss_gzip_t g = data;
+	z_stream zs, *pzs = &zs;
+	memset(&zs, 0, sizeof(zs));
+	if(deflateInit2(&zs, g->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY)!=Z_OK)
+		pzs = 0;
+	pthread_mutex_lock(&g->lock);
+	while(1) {
+		xcss_gzip_block_s *b = g->blocks + g->queued;
+		if(b->state!=XCSS_GZIP_QUEUED) {
+			if(g->stop)
+				break;
+			pthread_cond_wait(&g->cond, &g->lock);
+			continue;
+		}
+		b->state = XCSS_GZIP_COMPRESSING;
+		g->queued = (g->queued + 1) % g->count;
+		pthread_mutex_unlock(&g->lock);
+		block_deflate(b, pzs);
+		pthread_mutex_lock(&g->lock);
+		b->state = XCSS_GZIP_DONE;
+		pthread_cond_broadcast(&g->cond);
+	}
+	pthread_mutex_unlock(&g->lock);
+	if(pzs)
+		deflateEnd(pzs);
+	return 0;
+}
+
+static void start_workers(xcss_gzip_t g) {
+	g->workers = mem_alloc(g->threads*sizeof(pthread_t));
+	if(err()) {
+		err_clear();
+		return;
+	}
+	for(; g->started<g->threads; g->started++)
+		if(pthread_create(g->workers + g->started, 0, worker, g))
+			break;
+}
+
+/**
+ * Wait until block is compressed and write it, blocks are written in
+ * order of the ring.
+ */
+static void block_write(xcss_gzip_t g, xcss_gzip_block_s *b) {
+	if(b->state==XCSS_GZIP_FREE)
+		return;
+	if(g->started) {
+		pthread_mutex_lock(&g->lock);
+		while(b->state!=XCSS_GZIP_DONE)
+			pthread_cond_wait(&g->cond, &g->lock);
+		pthread_mutex_unlock(&g->lock);
+	}
+	file_write(g, b->out, b->out_used);
+	g->crc = crc32_combine(g->crc, b->crc, b->in_used);
+	g->length += b->in_used;
+	g->error |= b->error;
+	b->state = XCSS_GZIP_FREE;
+}
+
+static void block_queue(xcss_gzip_t g, xcss_gzip_block_s *b) {
+	if(g->started) {
+		pthread_mutex_lock(&g->lock);
+		b->state = XCSS_GZIP_QUEUED;
+		pthread_cond_broadcast(&g->cond);
+		pthread_mutex_unlock(&g->lock);
+	} else {
+		block_deflate(b, &g->zs);
+		b->state = XCSS_GZIP_DONE;
+	}
+}
+
+static void block_start(xcss_gzip_block_s *b, xcss_gzip_block_s *prev) {
+	if(!b->in) {
+		b->in = mem_alloc(XCSS_GZIP_WINDOW + XCSS_GZIP_BLOCK_SIZE);
+		if(err())
+			return;
+		b->out_size = BLOCK_OUT_SIZE;
+		b->out = mem_alloc(b->out_size);
+		if(err())
+			return;
+	}
+	b->state = XCSS_GZIP_FILLING;
+	b->last = 0;
+	b->in_used = 0;
+	b->error = 0;
+	b->dict_size = 0;
+	if(prev) {
+		b->dict_size = prev->in_used<XCSS_GZIP_WINDOW ? prev->in_used : XCSS_GZIP_WINDOW;
+		memcpy(b->in + XCSS_GZIP_WINDOW - b->dict_size,
+			   prev->in + XCSS_GZIP_WINDOW + prev->in_used - b->dict_size, b->dict_size);
+	}
+}
+
+static void block_next(xcss_gzip_t g) {
+	xcss_gzip_block_s *b = g->blocks + g->current, *nb;
+	if(!g->started && !g->workers)
+		start_workers(g);
+	block_queue(g, b);
+	g->current = (g->current + 1) % g->count;
+	nb = g->blocks + g->current;
+	block_write(g, nb);
+	block_start(nb, b);
+}
+
+static void put_le32(unsigned char *p, uLong v) {
+	p[0] = v & 0xFF;
+	p[1] = (v>>8) & 0xFF;
+	p[2] = (v>>16) & 0xFF;
+	p[3] = (v>>24) & 0xFF;
+}
+
+static void gzip_free(xcss_gzip_t g) {
+	int i;
+	if(g->blocks) {
+		for(i=0; i<g->count; i++) {
+			mem_free(g->blocks[i].in);
+			mem_free(g->blocks[i].out);
+		}
+		mem_free(g->blocks);
+		pthread_mutex_destroy(&g->lock);
+		pthread_cond_destroy(&g->cond);
+	}
+	mem_free(g->workers);
+	mem_free(g->out);
+	deflateEnd(&g->zs);
+	mem_free(g);
+}
+
+xcss_gzip_t xcss_gzip_create(FILE *f, int level, int threads) {
+	static const unsigned char header[10] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 3};
+	xcss_gzip_t g = mem_alloc(sizeof(xcss_gzip_s));
+	if(err())
+		return 0;
+	memset(g, 0, sizeof(xcss_gzip_s));
+	g->f = f;
+	g->level = level;
+	g->threads = threads<1 ? 1 : threads;
+	if(g->threads==1) {
+		g->out = mem_alloc(XCSS_GZIP_OUT_SIZE);
+		if(err())
+			goto error;
+		/* 16 + window bits makes zlib write gzip header and trailer */
+		if(deflateInit2(&g->zs, level, Z_DEFLATED, 16 + 15, 8, Z_DEFAULT_STRATEGY)!=Z_OK) {
+			err_set(e_xcss_io);
+			goto error;
+		}
+		return g;
+	}
+	/* raw stream for blocks compressed before workers are started */
+	if(deflateInit2(&g->zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY)!=Z_OK) {
+		err_set(e_xcss_io);
+		goto error;
+	}
+	g->count = g->threads*2;
+	g->blocks = mem_alloc(g->count*sizeof(xcss_gzip_block_s));
+	if(err())
+		goto error;
+	memset(g->blocks, 0, g->count*sizeof(xcss_gzip_block_s));
+	pthread_mutex_init(&g->lock, 0);
+	pthread_cond_init(&g->cond, 0);
+	g->crc = crc32(0, 0, 0);
+	block_start(g->blocks, 0);
+	if(err())
+		goto error;
+	file_write(g, header, sizeof(header));
+	return g;
+error:
+	gzip_free(g);
+	return 0;
+}
+
+void xcss_gzip_write(xcss_gzip_t g, const char *s, size_t sz) {
+	if(g->threads==1) {
+		g->zs.next_in = (unsigned char *)s;
+		g->zs.avail_in = sz;
+		serial_deflate(g, Z_NO_FLUSH);
+		return;
+	}
+	while(sz && !g->error) {
+		xcss_gzip_block_s *b = g->blocks + g->current;
+		size_t c = XCSS_GZIP_BLOCK_SIZE - b->in_used;
+		if(c>sz)
+			c = sz;
+		memcpy(b->in + XCSS_GZIP_WINDOW + b->in_used, s, c);
+		b->in_used += c;
+		s += c;
+		sz -= c;
+		if(b->in_used==XCSS_GZIP_BLOCK_SIZE) {
+			block_next(g);
+			if(err()) {
+				err_clear();
+				g->error = 1;
+			}
+		}
+	}
+}
+
+void xcss_gzip_sink(void *g, const char *s, size_t sz) {
+	xcss_gzip_write(g, s, sz);
+}
+
+void xcss_gzip_end(xcss_gzip_t g) {
+	int i;
+	if(g->threads==1)
+		serial_deflate(g, Z_FINISH);
+	else {
+		unsigned char trailer[8];
+		xcss_gzip_block_s *b = g->blocks + g->current;
+		if(b->in) {
+			b->last = 1;
+			block_queue(g, b);
+		}
+		for(i=1; i<=g->count; i++)
+			block_write(g, g->blocks + (g->current + i) % g->count);
+		if(g->started) {
+			pthread_mutex_lock(&g->lock);
+			g->stop = 1;
+			pthread_cond_broadcast(&g->cond);
+			pthread_mutex_unlock(&g->lock);
+			for(i=0; i<g->started; i++)
+				pthread_join(g->workers[i], 0);
+		}
+		put_le32(trailer, g->crc);
+		put_le32(trailer + 4, g->length);
+		file_write(g, trailer, sizeof(trailer));
+	}
+	if(g->error) {
+		gzip_free(g);
+		err_set(e_xcss_io);
+	} else
+		gzip_free(g);
+}
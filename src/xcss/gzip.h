@@ -0,0 +1,75 @@
+#ifndef MAY_GZIP_H
+#define MAY_GZIP_H
+
+#include "maylib/err.h"
+#include <stdio.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#define XCSS_GZIP_BLOCK_SIZE (1024*1024)
+#define XCSS_GZIP_WINDOW (1024*32)
+#define XCSS_GZIP_OUT_SIZE (1024*64)
+
+typedef enum {
+	XCSS_GZIP_FREE,
+	XCSS_GZIP_FILLING,
+	XCSS_GZIP_QUEUED,
+	XCSS_GZIP_COMPRESSING,
+	XCSS_GZIP_DONE
+} xcss_gzip_state_t;
+
+typedef struct {
+	xcss_gzip_state_t state;
+	int last;
+	char *in;              /* XCSS_GZIP_WINDOW of dictionary, then data */
+	size_t dict_size;
+	size_t in_used;
+	unsigned char *out;
+	size_t out_size;
+	size_t out_used;
+	uLong crc;
+	int error;
+} xcss_gzip_block_s;
+
+typedef struct xcss_gzip_ss {
+	FILE *f;
+	int level;
+	int threads;
+	int error;
+	/* serial stream, used when there is one thread */
+	z_stream zs;
+	unsigned char *out;
+	/* blocks, used in order as a ring */
+	xcss_gzip_block_s *blocks;
+	int count;
+	int current;
+	int queued;            /* next block for workers */
+	int started;           /* workers running */
+	int stop;
+	pthread_t *workers;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uLong crc;
+	uLong length;
+} xcss_gzip_s;
+
+typedef xcss_gzip_s *xcss_gzip_t;
+
+/**
+ * Gzip writer fed with output as it is generated. With one thread it is
+ * a single deflate stream. With more, output is cut to blocks deflated
+ * in parallel, each primed with the end of the previous one, and joined
+ * to one gzip member. Threads are started with the second block only.
+ */
+xcss_gzip_t xcss_gzip_create(FILE *, int level, int threads);
+void xcss_gzip_write(xcss_gzip_t, const char *, size_t);
+/**
+ * Sink for xcss_set_sink.
+ */
+void xcss_gzip_sink(void *, const char *, size_t);
+/**
+ * Finish stream and delete writer. Sets e_xcss_io if anything failed.
+ */
+void xcss_gzip_end(xcss_gzip_t);
+
+#endif /* MAY_GZIP_H */
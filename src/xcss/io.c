@@ -0,0 +1,183 @@
+#include "io.h"
+#include "maylib/utf.h"
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+ERR_DEFINE(e_xcss_io, "IO error.", 0);
+ERR_DEFINE(e_xcss_encoding, "Invalid encoding of input.", 0);
+
+#define FILE_BLOCK_SIZE (1024*64)
+
+typedef struct {
+	void *data;
+	size_t size;
+} mapping_s;
+
+static void unmap(void *data) {
+	mapping_s *m = data;
+	munmap(m->data, m->size);
+}
+
+static void release(void *data) {
+	mem_free(data);
+}
+
+/**
+ * Map whole regular file, return its content starting from offset.
+ */
+static str_t map_file(heap_t h, int fd, size_t size, size_t offset) {
+	mapping_s *m;
+	if(offset>=size)
+		return str_create(h, 0);
+	m = heap_alloc(h, sizeof(mapping_s));
+	if(err())
+		return 0;
+	m->size = size;
+	m->data = mmap(0, m->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(m->data==MAP_FAILED) {
+		err_set(e_xcss_io);
+		return 0;
+	}
+	heap_on_delete(h, unmap, m);
+	if(err()) {
+		munmap(m->data, m->size);
+		return 0;
+	}
+	madvise(m->data, m->size, MADV_SEQUENTIAL);
+	return str_interval(h, (char *)m->data + offset, (char *)m->data + m->size);
+}
+
+/**
+ * Read regular file of given size. If it was truncated meanwhile, the
+ * part read is returned.
+ */
+static str_t copy_file(heap_t h, int fd, size_t size) {
+	size_t len = 0;
+	str_t r = str_create(h, size);
+	if(err())
+		return 0;
+	while(len<size) {
+		ssize_t n = read(fd, str_begin(r) + len, size - len);
+		if(n<0 && errno==EINTR)
+			continue;
+		if(n<0) {
+			err_set(e_xcss_io);
+			return 0;
+		}
+		if(!n)
+			break;
+		len += n;
+	}
+	r->length = len;
+	str_begin(r)[len] = 0;
+	return r;
+}
+
+str_t xcss_read_stream(heap_t h, FILE *f) {
+	struct stat st;
+	size_t sz, len = 0, cap = FILE_BLOCK_SIZE;
+	char *buf;
+	off_t pos;
+	assert(h && f);
+	err_reset();
+	if(fstat(fileno(f), &st)==0 && S_ISREG(st.st_mode) && (pos = ftello(f))>=0)
+		return map_file(h, fileno(f), st.st_size, pos);
+	/* read in place to one buffer, growing it geometrically */
+	buf = mem_alloc(cap);
+	if(err())
+		return 0;
+	while((sz = fread(buf + len, 1, cap - len, f))) {
+		len += sz;
+		if(len==cap) {
+			/* old buffer is freed below if it can't grow */
+			char *nbuf = mem_realloc(buf, cap*2);
+			if(err())
+				goto error;
+			buf = nbuf;
+			cap *= 2;
+		}
+	}
+	if(ferror(f)) {
+		err_set(e_xcss_io);
+		goto error;
+	}
+	heap_on_delete(h, release, buf);
+	if(err())
+		goto error;
+	return str_interval(h, buf, buf + len);
+error:
+	mem_free(buf);
+	return 0;
+}
+
+static str_t read_file(heap_t h, str_t fname, int copy) {
+	struct stat st;
+	str_t content = 0;
+	int fd;
+	err_reset();
+	fname = str_clone(h, fname);
+	if(err())
+		return 0;
+	fd = open(str_begin(fname), O_RDONLY | O_CLOEXEC);
+	if(fd<0 || fstat(fd, &st)<0) {
+		err_set(e_xcss_io);
+		goto clean;
+	}
+	if(!S_ISREG(st.st_mode)) {
+		/* pipes and special files can't be mapped */
+		FILE *f = fdopen(fd, "r");
+		if(!f) {
+			err_set(e_xcss_io);
+			goto clean;
+		}
+		content = xcss_read_stream(h, f);
+		fclose(f);
+		return content;
+	}
+	if(copy)
+		content = copy_file(h, fd, st.st_size);
+	else
+		content = map_file(h, fd, st.st_size, 0);
+clean:
+	if(fd>=0)
+		close(fd);
+	return err() ? 0 : content;
+}
+
+str_t xcss_read_file(heap_t h, str_t fname) {
+	return read_file(h, fname, 0);
+}
+
+str_t xcss_copy_file(heap_t h, str_t fname) {
+	return read_file(h, fname, 1);
+}
+
+str_t xcss_decode(heap_t h, str_t src) {
+	char *p = str_begin(src), *r;
+	size_t sz = str_length(src), bom;
+	int enc;
+	err_reset();
+	enc = utf_detect(p, sz);
+	if(!enc)
+		enc = UTF_8;
+	bom = utf_bom_length(p, sz, enc);
+	p += bom;
+	sz -= bom;
+	if(enc==UTF_8) {
+		if(utf_validate(p, sz)!=sz) {
+			err_set(e_xcss_encoding);
+			return 0;
+		}
+		return bom ? str_interval(h, p, p + sz) : src;
+	}
+	r = utf_convert_n(h, p, sz, enc, UTF_8, &sz);
+	if(err()) {
+		err_replace(e_xcss_encoding);
+		return 0;
+	}
+	return str_interval(h, r, r + sz);
+}
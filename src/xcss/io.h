@@ -0,0 +1,36 @@
+#ifndef MAY_IO_H
+#define MAY_IO_H
+
+#include "maylib/err.h"
+#include "maylib/heap.h"
+#include "maylib/str.h"
+#include <stdio.h>
+
+ERR_DECLARE(e_xcss_io);
+ERR_DECLARE(e_xcss_encoding);
+
+/**
+ * Read whole stream without intermediate copies. Regular files are mapped,
+ * other streams are read to one buffer released with heap.
+ * WARNING Returned string is not zero-ended.
+ */
+str_t xcss_read_stream(heap_t, FILE *);
+/**
+ * Regular files are mapped to memory and unmapped when heap is deleted.
+ * WARNING Returned string is not zero-ended.
+ */
+str_t xcss_read_file(heap_t, str_t);
+/**
+ * Read file to memory of heap. Mapped files fault (SIGBUS) if they are
+ * truncated while mapped, so files kept longer than one compilation
+ * (cache of server and watch mode) are copied.
+ */
+str_t xcss_copy_file(heap_t, str_t);
+/**
+ * Make UTF-8 source of file content: drop byte order mark, transcode
+ * UTF-16 and UTF-32 and check UTF-8. Valid UTF-8 is not copied.
+ * Sets e_xcss_encoding if content is not valid.
+ */
+str_t xcss_decode(heap_t, str_t);
+
+#endif /* MAY_IO_H */
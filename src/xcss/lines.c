@@ -0,0 +1,63 @@
+#include "lines.h"
+#include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+size_t xcss_count_newlines(const char *s, size_t sz) {
+	const char *e = s + sz;
+	size_t r = 0;
+#ifdef __SSE2__
+	const __m128i nl = _mm_set1_epi8('\n');
+	for(; e - s>=64; s+=64) {
+		const __m128i *p = (const __m128i *)s;
+		unsigned long long m =
+			(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p), nl))
+			| (unsigned long long)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p + 1), nl))<<16
+			| (unsigned long long)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p + 2), nl))<<32
+			| (unsigned long long)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p + 3), nl))<<48;
+		r += __builtin_popcountll(m);
+	}
+#endif
+	for(; s<e; s++)
+		r += *s=='\n';
+	return r;
+}
+
+xcss_lines_t xcss_lines_create(heap_t h, str_t source) {
+	const char *s = str_begin(source), *e = str_end(source), *i;
+	size_t n = 1;
+	xcss_lines_t r = heap_alloc(h, sizeof(xcss_lines_s));
+	if(err())
+		return 0;
+	r->source = source;
+	r->count = xcss_count_newlines(s, e - s) + 1;
+	r->next = 0;
+	r->starts = heap_alloc(h, r->count*sizeof(size_t));
+	if(err())
+		return 0;
+	r->starts[0] = 0;
+	/* memchr is vectorized by libc */
+	for(i=s; (i = memchr(i, '\n', e - i)); i++)
+		r->starts[n++] = i + 1 - s;
+	assert(n==r->count);
+	return r;
+}
+
+void xcss_lines_find(xcss_lines_t l, size_t offset, size_t *line, size_t *column) {
+	size_t lo = 0, hi = l->count, c = 1;
+	const char *i, *e;
+	/* last line starting at or before offset */
+	while(hi - lo>1) {
+		size_t m = (lo + hi)/2;
+		if(l->starts[m]<=offset)
+			lo = m;
+		else
+			hi = m;
+	}
+	e = str_begin(l->source) + offset;
+	for(i=str_begin(l->source) + l->starts[lo]; i<e; i++)
+		c += (*i & 0xC0)!=0x80;   /* UTF-8 continuation bytes aren't characters */
+	*line = lo + 1;
+	*column = c;
+}
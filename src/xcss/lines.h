@@ -0,0 +1,31 @@
+#ifndef MAY_LINES_H
+#define MAY_LINES_H
+
+#include "maylib/err.h"
+#include "maylib/heap.h"
+#include "maylib/str.h"
+
+typedef struct xcss_lines_ss {
+	str_t source;
+	size_t count;      /* number of lines */
+	size_t *starts;    /* offset of the first byte of every line */
+	struct xcss_lines_ss *next;
+} xcss_lines_s;
+
+typedef xcss_lines_s *xcss_lines_t;
+
+/**
+ * Line start index of source. It is built only when a diagnostic
+ * needs it, so newlines are not tracked while parsing.
+ */
+xcss_lines_t xcss_lines_create(heap_t, str_t source);
+/**
+ * Line and column (in characters) of offset, both start from 1.
+ */
+void xcss_lines_find(xcss_lines_t, size_t offset, size_t *line, size_t *column);
+/**
+ * Count '\n' in buffer, 64 bytes at a time.
+ */
+size_t xcss_count_newlines(const char *, size_t);
+
+#endif /* MAY_LINES_H */
@@ -1,6 +1,19 @@
 
 #include "parser.h"
 #include "syntree.h"
+#include "deps.h"
+#include "io.h"
+#include "cache.h"
+#include "watch.h"
+#include "server.h"
+#include "trace.h"
+#include "used.h"
+#include "binary.h"
+#include "lines.h"
+#ifdef XCSS_ZLIB
+#include "gzip.h"
+#endif
+#include "xcss.h"
 #include "maylib/err.h"
 #include "maylib/str.h"
 #include "maylib/heap.h"
@@ -11,456 +24,1170 @@
 #include <assert.h>
 #include <errno.h>
 #include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <pthread.h>
 
-ERR_DECLARE(e_xcss_io_error);
-ERR_DEFINE(e_xcss_io, "IO error.", 0);
+typedef struct {
+	heap_t heap;
+	xcss_cache_t cache;
+	xcss_stats_t stats;
+	int source_map;
+	int gzip;
+	int shard;
+	int threads;
+	map_t used;
+	map_t vars;
+	int patch;
+	map_t patches;            /* output name to patch_s of the last compile */
+	FILE *serr;
+} cli_s;
 
-ERR_DECLARE(e_xcss_class);
-ERR_DEFINE(e_xcss_class, "Class not found.", 0);
+/* class blocks of a compile, for --patch */
+typedef struct {
+	heap_t heap;
+	map_t blocks;             /* selector to block, both zero-ended */
+} patch_s;
 
-ERR_DECLARE(e_xcss_variable);
-ERR_DEFINE(e_xcss_variable, "Variable not found.", 0);
+/* global variables of one output, written to out.name.css */
+typedef struct variant_ss {
+	str_t name;
+	map_t vars;
+	struct variant_ss *next;
+} variant_s;
 
-#define FILE_BLOCK_SIZE (1024*64)
+/* every input compiled with every variant, on threads */
+typedef struct {
+	cli_s *cli;
+	xcss_entry_t entries;
+	size_t count;
+	variant_s **variants;
+	size_t variant_count;
+	size_t next;
+	const err_t *error;
+	pthread_mutex_t lock;
+} variant_jobs_s;
 
-static str_t read_stream(heap_t h, FILE *f) {
-	size_t sz;
-	heap_t tmph;
-	sbuilder_t sb;
-	str_t r = 0;
-	assert(h && f);
-	tmph = heap_create(1024*64*4);
+/* output file and its compressed copy, written in the same pass */
+typedef struct {
+	FILE *out;
+	FILE *gz_out;
+#ifdef XCSS_ZLIB
+	xcss_gzip_t gzip;
+#endif
+} output_s;
+
+static FILE *open_output(const char *fname) {
+	FILE *f;
+	if(!fname)
+		return stdout;
+	f = fopen(fname, "w");
+	if(!f) {
+		fprintf(stderr, "Can\'t create output file \"%s\"\n", fname);
+		err_set(e_xcss_io);
+	}
+	return f;
+}
+
+static void close_output(FILE *f) {
+	if(f!=stdout)
+		fclose(f);
+}
+
+static str_t read_entry(heap_t h, xcss_entry_t e) {
+	str_t r = e->input ? xcss_read_file(h, e->input) : xcss_read_stream(h, stdin);
+	return err() ? 0 : xcss_decode(h, r);
+}
+
+static void write_diagnostics(xcss_t x, FILE *serr) {
+	xcss_diag_t d;
+	for(d=xcss_diagnostics(x); d; d=d->next) {
+		if(d->file) {
+			fwrite(str_begin(d->file), str_length(d->file), 1, serr);
+			if(!d->line)
+				fprintf(serr, ": ");
+		}
+		if(d->line)
+			fprintf(serr, "%s%zu:%zu: ", d->file ? ":" : "", d->line, d->column);
+		if(d->subject) {
+			fprintf(serr, "\"");
+			fwrite(str_begin(d->subject), str_length(d->subject), 1, serr);
+			fprintf(serr, "\": ");
+		}
+		fprintf(serr, "%s\n", d->error->message);
+	}
+}
+
+/**
+ * Sources are named relative to working directory, map is written
+ * next to output, so root leads from there back to working directory.
+ */
+static str_t map_root(heap_t h, const char *output) {
+	char buf[PATH_MAX];
+	const char *i, *s = output;
+	size_t n = 0;
+	if(*output!='/') {
+		for(i=output; *i; i++) {
+			if(*i!='/')
+				continue;
+			if(i - s==2 && s[0]=='.' && s[1]=='.')
+				break;
+			n += i - s>1 || (i - s==1 && s[0]!='.');
+			s = i + 1;
+		}
+		if(!*i) {
+			str_t r = str_from_cs(h, "");
+			for(; n && !err(); n--)
+				r = str_cat(h, r, str_from_cs(h, "../"));
+			return err() || !str_length(r) ? 0 : r;
+		}
+	}
+	if(!getcwd(buf, sizeof(buf) - 1))
+		return 0;
+	strcat(buf, "/");
+	return str_from_cs(h, buf);
+}
+
+static const char *base_name(const char *fname) {
+	const char *r = strrchr(fname, '/');
+	return r ? r + 1 : fname;
+}
+
+static FILE *open_suffixed(heap_t h, const char *output, const char *suffix) {
+	char *fname = heap_alloc(h, strlen(output) + strlen(suffix) + 1);
 	if(err())
 		return 0;
-	sb = sbuilder_create(tmph);
+	strcpy(fname, output);
+	strcat(fname, suffix);
+	return open_output(fname);
+}
+
+static xcss_smap_t open_map(heap_t h, xcss_entry_t e, FILE **f) {
+	xcss_smap_t r;
+	*f = open_suffixed(h, e->output, ".map");
 	if(err())
 		return 0;
-	do {
-		str_t s = str_create(tmph, FILE_BLOCK_SIZE);
+	r = xcss_smap_create(h, str_from_cs(h, base_name(e->output)), map_root(h, e->output), xcss_file_sink, *f);
+	if(err()) {
+		fclose(*f);
+		*f = 0;
+	}
+	return r;
+}
+
+static void output_sink(void *data, const char *s, size_t sz) {
+	output_s *o = data;
+	fwrite(s, 1, sz, o->out);
+#ifdef XCSS_ZLIB
+	if(o->gzip)
+		xcss_gzip_write(o->gzip, s, sz);
+#endif
+}
+
+static void open_outputs(cli_s *cli, heap_t h, output_s *o, const char *fname) {
+	o->gz_out = 0;
+#ifdef XCSS_ZLIB
+	o->gzip = 0;
+#endif
+	o->out = open_output(fname);
+	if(err())
+		return;
+#ifdef XCSS_ZLIB
+	if(cli->gzip) {
+		o->gz_out = open_suffixed(h, fname, ".gz");
 		if(err())
-			goto clean;
-		sz = fread(str_begin(s), 1, FILE_BLOCK_SIZE, f);
-		if(sz) {
-			str_t tmp = str_interval(tmph, str_begin(s), str_begin(s) + sz);
-			if(err())
-				goto clean;
-			sbuilder_append(sb, tmp);
-			if(err())
-				goto clean;
-		}
-	} while(sz==FILE_BLOCK_SIZE);
-	r = sbuilder_get(h, sb);
-clean:
-	heap_delete(tmph);
+			return;
+		o->gzip = xcss_gzip_create(o->gz_out, Z_BEST_COMPRESSION, cli->threads);
+	}
+#endif
+}
+
+static void close_outputs(output_s *o) {
+	if(o->out)
+		close_output(o->out);
+#ifdef XCSS_ZLIB
+	if(o->gzip) {
+		const err_t *e = err_get();
+		err_clear();
+		xcss_gzip_end(o->gzip);
+		if(err())
+			fprintf(stderr, "Can't write compressed output.\n");
+		else if(e)
+			err_replace(e);
+	}
+#endif
+	if(o->gz_out)
+		fclose(o->gz_out);
+}
+
+/**
+ * Output split by top-level namespaces, out.css gets classes outside
+ * of namespaces and namespace ns goes to out.ns.css.
+ */
+typedef struct {
+	cli_s *cli;
+	heap_t heap;
+	const char *output;
+	output_s *common;
+	map_t files;       /* namespace -> shard_s */
+	int error;
+} shards_s;
+
+typedef struct {
+	const char *fname;
+	output_s out;
+} shard_s;
+
+static char *shard_name(heap_t h, const char *output, str_t ns) {
+	const char *dot = strrchr(base_name(output), '.');
+	size_t pre = dot ? (size_t)(dot - output) : strlen(output);
+	char *r = heap_alloc(h, strlen(output) + str_length(ns) + 2);
+	if(err())
+		return 0;
+	memcpy(r, output, pre);
+	r[pre] = '.';
+	memcpy(r + pre + 1, str_begin(ns), str_length(ns));
+	strcpy(r + pre + 1 + str_length(ns), output + pre);
 	return r;
 }
 
-static str_t read_file(heap_t h, str_t fname) {
-	size_t sz;
-	str_t content;
-	err_reset();
-	fname = str_clone(h, fname);
+static shard_s *shard_open(shards_s *sh, str_t ns) {
+	str_t key;
+	shard_s *r = heap_alloc(sh->heap, sizeof(shard_s));
 	if(err())
 		return 0;
-	FILE *f = fopen(str_begin(fname), "r");
-	if(!f) {
-		err_set(e_xcss_io);
-		goto clean;
+	r->fname = shard_name(sh->heap, sh->output, ns);
+	if(err())
+		return 0;
+	open_outputs(sh->cli, sh->heap, &r->out, r->fname);
+	if(err()) {
+		close_outputs(&r->out);
+		return 0;
 	}
-	fseek(f, 0L, SEEK_END);
-	sz = ftell(f);
-	fseek(f, 0L, SEEK_SET);
-	content = str_create(h, sz);
+	/* names are released with sources before the manifest is written */
+	key = str_clone(sh->heap, ns);
 	if(err())
-		goto clean;
-	if(fread(str_begin(content), 1, sz, f)!=sz)
-		err_set(e_xcss_io);
-clean:
+		return 0;
+	map_set(sh->files, key, r);
+	return r;
+}
+
+static void shard_sink(void *data, str_t ns, const char *s, size_t sz) {
+	shards_s *sh = data;
+	shard_s *f;
+	if(!ns) {
+		output_sink(sh->common, s, sz);
+		return;
+	}
+	f = map_get(sh->files, ns);
+	if(!f && !sh->error) {
+		f = shard_open(sh, ns);
+		if(err()) {
+			err_clear();
+			sh->error = 1;
+		}
+	}
 	if(f)
-		fclose(f);
-	return err() ? 0 : content;
+		output_sink(&f->out, s, sz);
 }
 
-typedef struct xcss_rule_ss {
-	str_t name;
-	str_t value;
-	struct xcss_rule_ss *next;
-} xcss_rule_s;
+static void write_json_string(FILE *f, const char *s) {
+	fputc('"', f);
+	for(; *s; s++) {
+		unsigned char c = *s;
+		if(c=='"' || c=='\\')
+			fprintf(f, "\\%c", c);
+		else if(c<0x20)
+			fprintf(f, "\\u%04x", c);
+		else
+			fputc(c, f);
+	}
+	fputc('"', f);
+}
 
-typedef xcss_rule_s *xcss_rule_t;
+static void write_manifest(shards_s *sh) {
+	map_node_t i;
+	FILE *f = open_suffixed(sh->heap, sh->output, ".manifest.json");
+	if(err())
+		return;
+	fprintf(f, "{\"common\":");
+	write_json_string(f, base_name(sh->output));
+	fprintf(f, ",\"namespaces\":{");
+	for(i=map_begin(sh->files); i; i=map_next(i)) {
+		shard_s *s = i->value;
+		if(i!=map_begin(sh->files))
+			fprintf(f, ",");
+		/* keys are cloned, so they are zero-ended */
+		write_json_string(f, str_begin(i->key));
+		fprintf(f, ":");
+		write_json_string(f, base_name(s->fname));
+	}
+	fprintf(f, "}}\n");
+	fclose(f);
+}
 
-typedef struct xcss_class_ss {
-	str_t name;
-	str_t prefix;
-	heap_t heap;
-	xcss_rule_t first_rule;
-	xcss_rule_t last_rule;
-} xcss_class_s;
+static void close_shards(shards_s *sh) {
+	map_node_t i;
+	for(i=map_begin(sh->files); i; i=map_next(i))
+		close_outputs(&((shard_s *)i->value)->out);
+}
 
-typedef xcss_class_s *xcss_class_t;
+static void close_entry(output_s *out, shards_s *sh) {
+	close_outputs(out);
+	if(sh)
+		close_shards(sh);
+}
 
-static xcss_class_t class_create(heap_t h, str_t nm, str_t prefix) {
-	xcss_class_t cl = heap_alloc(h, sizeof(xcss_class_s));
+static patch_s *patch_create(void) {
+	patch_s *r;
+	heap_t h = heap_create(0);
 	if(err())
 		return 0;
-	cl->name = nm;
-	cl->prefix = prefix;
-	cl->heap = h;
-	cl->first_rule = cl->last_rule = 0;
-	return cl;
+	r = heap_alloc(h, sizeof(patch_s));
+	if(!err()) {
+		r->heap = h;
+		r->blocks = map_create(h);
+	}
+	if(err()) {
+		heap_delete(h);
+		return 0;
+	}
+	return r;
 }
 
-static void class_append_rule(xcss_class_t cl, str_t nm, str_t val) {
-	xcss_rule_t i, prev;
-	xcss_rule_t r = heap_alloc(cl->heap, sizeof(xcss_rule_s));
+static void patch_class(void *data, str_t selector, str_t block) {
+	patch_s *p = data;
+	str_t prev = map_get(p->blocks, selector);
+	/* a selector written twice keeps both blocks */
+	block = str_clone(p->heap, block);
+	if(!err() && prev)
+		block = str_cat(p->heap, prev, block);
 	if(err())
 		return;
-	r->name = nm;
-	r->value = val;
-	r->next = 0;
-	for(i=cl->first_rule, prev=0; i; prev=i, i=i->next) {
-		if(str_equal(i->name, nm)) {
-			if(!prev)
-				cl->first_rule = i->next;
-			else if(!i->next) {
-				cl->last_rule = prev;
-				prev->next = 0;
-			} else
-				prev->next = i->next;
-			break;
+	if(!prev) {
+		selector = str_clone(p->heap, selector);
+		if(err())
+			return;
+	}
+	map_set(p->blocks, selector, block);
+}
+
+static void write_patch(heap_t h, const char *output, patch_s *old, patch_s *p) {
+	map_node_t i;
+	int n = 0;
+	FILE *f = open_suffixed(h, output, ".patch.json");
+	if(err())
+		return;
+	fprintf(f, "{\"added\":{");
+	for(i=map_begin(p->blocks); i; i=map_next(i)) {
+		if(old && map_get(old->blocks, i->key))
+			continue;
+		fprintf(f, n++ ? "," : "");
+		write_json_string(f, str_begin(i->key));
+		fprintf(f, ":");
+		write_json_string(f, str_begin((str_t)i->value));
+	}
+	fprintf(f, "},\"changed\":{");
+	for(n=0, i=map_begin(p->blocks); i && old; i=map_next(i)) {
+		str_t prev = map_get(old->blocks, i->key);
+		if(!prev || str_equal(prev, i->value))
+			continue;
+		fprintf(f, n++ ? "," : "");
+		write_json_string(f, str_begin(i->key));
+		fprintf(f, ":");
+		write_json_string(f, str_begin((str_t)i->value));
+	}
+	fprintf(f, "},\"removed\":[");
+	for(n=0, i=old ? map_begin(old->blocks) : 0; i; i=map_next(i)) {
+		if(map_get(p->blocks, i->key))
+			continue;
+		fprintf(f, n++ ? "," : "");
+		write_json_string(f, str_begin(i->key));
+	}
+	fprintf(f, "]}\n");
+	if(fclose(f))
+		err_set(e_xcss_io);
+}
+
+/**
+ * Write differences from the previous compile of output to
+ * out.css.patch.json and keep blocks of this one. Takes ownership of p.
+ */
+static void patch_update(cli_s *cli, heap_t h, const char *output, patch_s *p) {
+	may_str_s key;
+	patch_s *old = 0;
+	str_t k;
+	key.data = (char *)output;
+	key.length = strlen(output);
+	key.hash = 0;
+	if(!cli->patches)
+		cli->patches = map_create(cli->heap);
+	if(!err())
+		old = map_get(cli->patches, &key);
+	if(!err())
+		write_patch(h, output, old, p);
+	if(err()) {
+		heap_delete(p->heap);
+		return;
+	}
+	if(old) {
+		map_set(cli->patches, &key, p);
+		heap_delete(old->heap);
+	} else {
+		k = str_from_cs(cli->heap, output);
+		if(!err())
+			map_set(cli->patches, k, p);
+		if(err())
+			heap_delete(p->heap);
+	}
+}
+
+static void patches_delete(cli_s *cli) {
+	map_node_t i;
+	for(i=cli->patches ? map_begin(cli->patches) : 0; i; i=map_next(i))
+		heap_delete(((patch_s *)i->value)->heap);
+	cli->patches = 0;
+}
+
+static void compile_entry(void *data, xcss_entry_t e) {
+	cli_s *cli = data;
+	xcss_t x;
+	heap_t h = e->heap ? e->heap : cli->heap;
+	xcss_smap_t map = 0;
+	FILE *map_out = 0;
+	output_s out;
+	shards_s shards, *sh = 0;
+	patch_s *patch = 0;
+	open_outputs(cli, h, &out, e->output);
+	if(err())
+		goto clean;
+	x = xcss_create(h);
+	if(err())
+		goto clean;
+	if(cli->source_map) {
+		map = open_map(h, e, &map_out);
+		if(err())
+			goto clean;
+		xcss_set_source_map(x, map);
+	}
+	if(cli->shard) {
+		sh = &shards;
+		sh->cli = cli;
+		sh->heap = h;
+		sh->output = e->output;
+		sh->common = &out;
+		sh->error = 0;
+		sh->files = map_create(h);
+		if(err())
+			goto clean;
+		xcss_set_shard_sink(x, shard_sink, sh);
+	} else
+		xcss_set_sink(x, output_sink, &out);
+	xcss_set_cache(x, cli->cache);
+	xcss_set_includes(x, e->deps);
+	xcss_set_stats(x, cli->stats);
+	xcss_set_used(x, cli->used);
+	xcss_set_threads(x, cli->threads);
+	xcss_set_vars(x, cli->vars);
+	if(cli->patch) {
+		patch = patch_create();
+		if(err())
+			goto clean;
+		xcss_set_class_hook(x, patch_class, patch);
+	}
+	if(err())
+		goto clean;
+	if(e->input)
+		xcss_compile_file(x, e->input);
+	else {
+		str_t cnt;
+		xcss_phase_t p = cli->stats ? xcss_stats_phase(cli->stats, XCSS_PHASE_READ) : 0;
+		cnt = xcss_read_stream(x->heap, stdin);
+		if(cli->stats)
+			xcss_stats_phase(cli->stats, p);
+		if(err())
+			goto clean;
+		xcss_compile(x, 0, cnt);
+	}
+	if(err())
+		write_diagnostics(x, cli->serr);
+	else if(map) {
+		char url[PATH_MAX + 32];
+		xcss_smap_end(map);
+		snprintf(url, sizeof(url), "/*# sourceMappingURL=%s.map */\n", base_name(e->output));
+		output_sink(&out, url, strlen(url));
+	}
+	if(sh && !err()) {
+		if(sh->error) {
+			err_set(e_xcss_io);
+		} else {
+			write_manifest(sh);
 		}
 	}
-	if(cl->last_rule) {
-		cl->last_rule->next = r;
-		cl->last_rule = r;
+	if(patch && !err()) {
+		patch_update(cli, h, e->output, patch);
+		patch = 0;
+	}
+clean:
+	if(patch)
+		heap_delete(patch->heap);
+	if(map_out)
+		fclose(map_out);
+	if(cli->stats) {
+		xcss_phase_t p = xcss_stats_phase(cli->stats, XCSS_PHASE_OUTPUT);
+		close_entry(&out, sh);
+		xcss_stats_phase(cli->stats, p);
 	} else
-		cl->last_rule = cl->first_rule = r;
-	return;
-}
-
-void class_write(xcss_class_t cl, FILE *f) {
-	xcss_rule_t i;
-	fwrite(".", 1, 1, f);
-	if(cl->prefix)
-		fwrite(str_begin(cl->prefix), str_length(cl->prefix), 1, f);
-	fwrite(str_begin(cl->name), str_length(cl->name), 1, f);
-	fprintf(f, " {\n");
-	for(i=cl->first_rule; i; i=i->next) {
-		fwrite("\t", 1, 1, f);
-		fwrite(str_begin(i->name), str_length(i->name), 1, f);
-		fprintf(f, ": ");
-		fwrite(str_begin(i->value), str_length(i->value), 1, f);
-		fprintf(f, ";\n");
-	}
-	fprintf(f, "}\n\n");
-}
-
-static void class_append_class(xcss_class_t cl, xcss_class_t p) {
-	if(p) {
-		xcss_rule_t i;
-		for(i=p->first_rule; i; i=i->next) {
-			class_append_rule(cl, i->name, i->value);
+		close_entry(&out, sh);
+}
+
+/**
+ * Options of server request, one per line: -Dname=value (added to -D of
+ * command line) or --source-map (map is appended to output inline).
+ */
+static void request_options(cli_s *cli, heap_t h, str_t options, map_t *vars, int *source_map, FILE *serr) {
+	str_it_t i, e, le, eq;
+	*vars = cli->vars;
+	*source_map = 0;
+	if(!options)
+		return;
+	e = str_end(options);
+	for(i=str_begin(options); i<e; i=le+1) {
+		le = memchr(i, '\n', e - i);
+		if(!le)
+			le = e;
+		if(le==i)
+			continue;
+		if(le - i==12 && !memcmp(i, "--source-map", 12)) {
+			*source_map = 1;
+			continue;
+		}
+		eq = le - i>2 && i[0]=='-' && i[1]=='D' ? memchr(i + 2, '=', le - i - 2) : 0;
+		if(!eq || eq==i + 2) {
+			fprintf(serr, "Invalid option \"%.*s\".\n", (int)(le - i), i);
+			err_set(e_arguments);
+			return;
+		}
+		if(*vars==cli->vars) {
+			map_node_t v;
+			*vars = map_create(h);
+			for(v=cli->vars ? map_begin(cli->vars) : 0; v && !err(); v=map_next(v))
+				map_set(*vars, v->key, v->value);
 			if(err())
 				return;
 		}
+		map_set(*vars, str_interval(h, i + 2, eq), str_interval(h, eq + 1, le));
+		if(err())
+			return;
 	}
 }
 
-typedef struct xcss_ns_ss {
-	map_t classes;
-	map_t vars;
-	struct xcss_ns_ss *parent;
-} xcss_ns_s;
-
-typedef xcss_ns_s *xcss_ns_t;
+static void write_base64(FILE *f, const unsigned char *s, size_t sz) {
+	static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	size_t i;
+	for(i=0; i<sz; i+=3) {
+		unsigned long v = (unsigned long)s[i]<<16;
+		if(i + 1<sz)
+			v |= s[i + 1]<<8;
+		if(i + 2<sz)
+			v |= s[i + 2];
+		fputc(digits[v>>18], f);
+		fputc(digits[(v>>12) & 63], f);
+		fputc(i + 1<sz ? digits[(v>>6) & 63] : '=', f);
+		fputc(i + 2<sz ? digits[v & 63] : '=', f);
+	}
+}
 
-static xcss_ns_t ns_create(heap_t h, xcss_ns_t p) {
-	xcss_ns_t r = heap_alloc(h, sizeof(xcss_ns_s));
-	r->parent = p;
+static void serve_request(void *data, heap_t h, str_t fname, str_t source, str_t options, FILE *sout, FILE *serr) {
+	cli_s *cli = data;
+	xcss_t x;
+	xcss_smap_t map = 0;
+	FILE *map_out = 0;
+	char *map_buf = 0;
+	size_t map_size = 0;
+	map_t vars;
+	int source_map;
+	request_options(cli, h, options, &vars, &source_map, serr);
 	if(err())
-		return 0;
-	r->classes = map_create(h);
+		return;
+	x = xcss_create(h);
 	if(err())
-		return 0;
-	r->vars = map_create(h);
+		return;
+	xcss_set_sink(x, xcss_file_sink, sout);
+	xcss_set_cache(x, cli->cache);
+	xcss_set_vars(x, vars);
+	if(source_map) {
+		map_out = open_memstream(&map_buf, &map_size);
+		if(!map_out) {
+			err_set(e_xcss_io);
+			return;
+		}
+		map = xcss_smap_create(h, 0, 0, xcss_file_sink, map_out);
+		if(!err())
+			xcss_set_source_map(x, map);
+	}
 	if(err())
-		return 0;
-	return r;
+		goto clean;
+	if(fname)
+		xcss_compile_file(x, fname);
+	else
+		xcss_compile(x, 0, source);
+	if(err())
+		write_diagnostics(x, serr);
+	else if(map) {
+		xcss_smap_end(map);
+		fflush(map_out);
+		fprintf(sout, "/*# sourceMappingURL=data:application/json;base64,");
+		write_base64(sout, (const unsigned char *)map_buf, map_size);
+		fprintf(sout, " */\n");
+	}
+clean:
+	if(map_out) {
+		fclose(map_out);
+		free(map_buf);
+	}
 }
 
-static void ns_add_var(xcss_ns_t ns, str_t nm, str_t vl) {
-	map_set(ns->vars, nm, vl);
+static void list_entry(heap_t h, xcss_entry_t e) {
+	FILE *out;
+	str_t cnt = read_entry(h, e);
+	if(err())
+		return;
+	out = open_output(e->output);
+	if(err())
+		return;
+	xcss_list_includes(h, 0, cnt, out, stderr);
+	close_output(out);
 }
 
-static str_t ns_get_var(xcss_ns_t ns, str_t nm) {
-	for(; ns; ns=ns->parent) {
-		str_t r = map_get(ns->vars, nm);
-		if(r)
-			return r;
+static void emit_entry(cli_s *cli, xcss_entry_t e) {
+	heap_t h = cli->heap;
+	struct stat st;
+	str_t cnt, bname;
+	syntree_t tree;
+	str_it_t error = 0;
+	FILE *out;
+	if(stat(str_begin(e->input), &st)!=0) {
+		fprintf(stderr, "Can't read input file \"%s\"\n", str_begin(e->input));
+		err_set(e_xcss_io);
+		return;
+	}
+	cnt = read_entry(h, e);
+	if(err())
+		return;
+	tree = xcss_to_syntree_parallel(h, cnt, cli->threads, &error);
+	if(err()) {
+		const err_t *pe = err_get();
+		err_clear();
+		if(pe==e_xcss_syntax && error) {
+			size_t line, column;
+			xcss_lines_t l = xcss_lines_create(h, cnt);
+			if(err())
+				return;
+			xcss_lines_find(l, error - str_begin(cnt), &line, &column);
+			fprintf(stderr, "%s:%zu:%zu: ", str_begin(e->input), line, column);
+		}
+		fprintf(stderr, "%s\n", pe->message);
+		err_replace(pe);
+		return;
+	}
+	bname = xcss_binary_name(h, e->input);
+	if(err())
+		return;
+	out = fopen(str_begin(bname), "wb");
+	if(!out) {
+		fprintf(stderr, "Can\'t create output file \"%s\"\n", str_begin(bname));
+		err_set(e_xcss_io);
+		return;
+	}
+	xcss_binary_write(out, cnt, &st, tree);
+	if(fclose(out) && !err())
+		err_set(e_xcss_io);
+	if(err()) {
+		fprintf(stderr, "Can\'t write output file \"%s\"\n", str_begin(bname));
+		remove(str_begin(bname));
 	}
-	return 0;
 }
 
-static void ns_add_class(xcss_ns_t ns, xcss_class_t vl) {
-	map_set(ns->classes, vl->name, vl);
+static void read_used(cli_s *cli, const char *fname) {
+	str_t text;
+	if(!cli->used) {
+		cli->used = map_create(cli->heap);
+		if(err())
+			return;
+	}
+	text = xcss_read_file(cli->heap, str_from_cs(cli->heap, fname));
+	if(!err())
+		text = xcss_decode(cli->heap, text);
+	if(err()) {
+		fprintf(stderr, "Can't read used classes from \"%s\"\n", fname);
+		return;
+	}
+	xcss_scan_used(cli->heap, cli->used, text);
 }
 
-
-static xcss_class_t ns_get_class(xcss_ns_t ns, str_t nm) {
-	for(; ns; ns=ns->parent) {
-		xcss_class_t r = map_get(ns->classes, nm);
-		if(r)
-			return r;
+static void add_define(cli_s *cli, const char *def) {
+	const char *eq = strchr(def, '=');
+	str_t nm, vl;
+	if(!eq || eq==def) {
+		fprintf(stderr, "Invalid argument. name=value expected after -D.\nUse --help option for more information.\n");
+		err_set(e_arguments);
+		return;
 	}
-	return 0;
+	if(!cli->vars) {
+		cli->vars = map_create(cli->heap);
+		if(err())
+			return;
+	}
+	nm = str_interval(cli->heap, (str_it_t)def, (str_it_t)eq);
+	if(err())
+		return;
+	vl = str_from_cs(cli->heap, eq + 1);
+	if(err())
+		return;
+	map_set(cli->vars, nm, vl);
 }
 
-
-static str_t get_rule_value(heap_t h, xcss_ns_t ns, syntree_node_t nd, FILE *serr) {
-	str_t r;
-	assert(syntree_name(nd)==XCSS_NODE_VALUE);
-	r = str_from_cs(h, "");
-	if(err())
+/**
+ * Variants file has a namespace-like block of variables for every
+ * variant: name [ var: value; ... ]. Values are taken as they are.
+ */
+static variant_s *read_variants(cli_s *cli, const char *fname) {
+	heap_t h = cli->heap;
+	variant_s *first = 0, **last = &first, *v;
+	syntree_node_t i, j;
+	str_it_t error = 0, e;
+	syntree_t st;
+	str_t text = xcss_read_file(h, str_from_cs(h, fname));
+	if(!err())
+		text = xcss_decode(h, text);
+	if(err()) {
+		fprintf(stderr, "Can't read variants from \"%s\"\n", fname);
 		return 0;
-	for(nd=syntree_child(nd); nd; nd=syntree_next(nd)) {
-		str_t s = syntree_value(nd);
+	}
+	st = xcss_to_syntree_ex(h, text, &error);
+	if(err())
+		goto invalid;
+	for(i=syntree_begin(st); i; i=syntree_next(i)) {
+		if(syntree_name(i)==XCSS_NODE_COMMENT)
+			continue;
+		if(syntree_name(i)!=XCSS_NODE_NAMESPACE) {
+			error = syntree_child(i) ? syntree_child(i)->position : i->position;
+			err_set(e_xcss_syntax);
+			goto invalid;
+		}
+		v = heap_alloc(h, sizeof(variant_s));
 		if(err())
 			return 0;
-		if(syntree_name(nd)==XCSS_NODE_TEXT) {
-			r = str_cat(h, r, s);
-			if(err())
-				return 0;
-		} else { /* XCSS_NODE_NAME */
-			str_t c = ns_get_var(ns, s);
+		j = syntree_child(i);
+		v->name = syntree_value(j);
+		if(err())
+			return 0;
+		v->vars = map_create(h);
+		if(err())
+			return 0;
+		for(j=syntree_next(j); j; j=syntree_next(j)) {
+			syntree_node_t nm;
+			if(syntree_name(j)==XCSS_NODE_COMMENT)
+				continue;
+			if(syntree_name(j)!=XCSS_NODE_RULE) {
+				error = syntree_child(j) ? syntree_child(j)->position : j->position;
+				err_set(e_xcss_syntax);
+				goto invalid;
+			}
+			nm = syntree_child(j);
+			/* value goes up to ';' */
+			e = memchr(syntree_next(nm)->position, ';', str_end(text) - syntree_next(nm)->position);
+			map_set(v->vars, syntree_value(nm), str_interval(h, syntree_next(nm)->position, e));
 			if(err())
 				return 0;
-			if(!c) {
-				fprintf(serr, "Variable \"");
-				fwrite(str_begin(c), str_length(c), 1, serr);
-				fprintf(serr, "\" not found.\n");
-				err_set(e_xcss_variable);
-				return 0;
-			} else {
-				r = str_cat(h, r, c);
-				if(err())
-					return 0;
-			}
 		}
+		v->next = 0;
+		*last = v;
+		last = &v->next;
 	}
-	return r;
+	if(!first) {
+		fprintf(stderr, "No variants in \"%s\"\n", fname);
+		err_set(e_xcss_syntax);
+	}
+	return first;
+invalid:
+	if(err_get()==e_xcss_syntax && error) {
+		size_t line, column;
+		xcss_lines_t l;
+		err_clear();
+		l = xcss_lines_create(h, text);
+		if(err())
+			return 0;
+		xcss_lines_find(l, error - str_begin(text), &line, &column);
+		fprintf(stderr, "%s:%zu:%zu: ", fname, line, column);
+		err_set(e_xcss_syntax);
+	}
+	fprintf(stderr, "%s\n", err_get()->message);
+	return 0;
 }
 
-static void xcss_process_node(heap_t h,
-							  syntree_node_t stn,
-							  xcss_ns_t ns,
-							  str_t fprefix,
-							  str_t name_prefix,
-							  FILE *sout,
-							  FILE *serr) {
-	switch(syntree_name(stn)) {
-		case XCSS_NODE_NAMESPACE: {
-			str_t nmp2;
-			xcss_ns_t ns2 = ns_create(h, ns);
-			if(err())
-				return;
-			stn = syntree_child(stn);
-			assert(syntree_name(stn)==XCSS_NODE_NAME);
-			nmp2 = syntree_value(stn);
-			if(err())
-				return;
-			str_t tmp = str_from_cs(h, "-");
-			if(err())
-				return;
-			nmp2 = str_cat(h, nmp2, tmp);
-			if(err())
-				return;
-			if(name_prefix) {
-				nmp2 = str_cat(h, name_prefix, nmp2);
-				if(err())
-					return;
-			}
-			for(stn=syntree_next(stn); stn; stn=syntree_next(stn)) {
-				xcss_process_node(h, stn, ns2, fprefix, nmp2, sout, serr);
-				if(err())
-					return;
-			}
-			break;
-		}
-		case XCSS_NODE_CLASS: {
-			xcss_class_t cl;
-			str_t tmp;
-			stn = syntree_child(stn);
-			assert(syntree_name(stn)==XCSS_NODE_CLASS_NAME);
-			tmp = syntree_value(stn);
-			if(err())
-				return;
-			cl = class_create(h, tmp, name_prefix);
-			if(err())
-				return;
-			ns_add_class(ns, cl);
-			if(err())
-				return;
-			stn = syntree_next(stn);
-			if(stn ? syntree_name(stn)==XCSS_NODE_CLASS_PARENT : 0) {
-				syntree_node_t i;
-				for(i=syntree_child(stn); i; i=syntree_next(i)) {
-					xcss_class_t pc;
-					tmp = syntree_value(i);
-					if(err())
-						return;
-					pc = ns_get_class(ns, tmp);
-					if(pc) {
-						class_append_class(cl, pc);
-						if(err())
-							return;
-					} else {
-						fprintf(serr, "Class \"");
-						fwrite(str_begin(tmp), str_length(tmp), 1, serr);
-						fprintf(serr, "\" not found.\n");
-						err_set(e_xcss_class);
-						return;
-					}
-				}
-				stn = syntree_next(stn);
-			}
-			for(; stn; stn=syntree_next(stn)) {
-				str_t nm, vl;
-				syntree_node_t i = syntree_child(stn);
-				assert(syntree_name(i)==XCSS_NODE_NAME);
-				nm = syntree_value(i);
-				if(err())
-					return;
-				i = syntree_next(i);
-				vl = get_rule_value(h, ns, i, serr);
-				if(err())
-					return;
-				class_append_rule(cl, nm, vl);
-			}
-			class_write(cl, sout);
-			ns_add_class(ns, cl);
+static void *variant_worker(void *data) {
+	variant_jobs_s *j = data;
+	size_t k;
+	while(1) {
+		cli_s cli;
+		xcss_entry_s e;
+		variant_s *v;
+		pthread_mutex_lock(&j->lock);
+		k = j->next++;
+		pthread_mutex_unlock(&j->lock);
+		if(k>=j->count*j->variant_count)
 			break;
+		v = j->variants[k % j->variant_count];
+		e = j->entries[k / j->variant_count];
+		/* variants run in parallel, each of them on one thread */
+		cli = *j->cli;
+		cli.vars = v->vars;
+		cli.threads = 1;
+		e.deps = 0;
+		e.heap = heap_create(0);
+		if(!err()) {
+			e.output = shard_name(e.heap, e.output, v->name);
+			if(!err())
+				compile_entry(&cli, &e);
+			heap_delete(e.heap);
 		}
-		case XCSS_NODE_RULE: {
-			str_t nm, vl;
-			syntree_node_t i = syntree_child(stn);
-			assert(syntree_name(i)==XCSS_NODE_NAME);
-			nm = syntree_value(i);
-			if(err())
-				return;
-			i = syntree_next(i);
-			vl = get_rule_value(h, ns, i, serr);
-			if(err())
-				return;
-			ns_add_var(ns, nm, vl);
-			break;
+		if(err()) {
+			pthread_mutex_lock(&j->lock);
+			if(!j->error)
+				j->error = err_get();
+			pthread_mutex_unlock(&j->lock);
+			err_clear();
 		}
-		case XCSS_NODE_INCLUDE: {
-			str_t fname, cnt;
-			str_it_t si;
-			syntree_t st;
-			syntree_node_t i = syntree_child(stn);
-			assert(syntree_name(i)==XCSS_NODE_INCLUDE_NAME);
-			fname = syntree_value(i);
-			if(err())
-				return;
-			if(fprefix)
-				fname = str_cat(h, fprefix, fname);
-			if(err())
-				return;
-			for(si=str_end(fname)-1; si>str_begin(fname); si--) {
-				if(*si=='/') {
-					fprefix = str_interval(h, str_begin(fname), si+1);
-					if(err())
-						return;
-				}
-			}
-			cnt = read_file(h, fname);
-			if(err())
-				return;
-			st = xcss_to_syntree(h, cnt);
+	}
+	return 0;
+}
+
+/**
+ * Sources are parsed once to the cache, so a variant costs only
+ * evaluation.
+ */
+static void compile_variants(cli_s *cli, xcss_entry_t entries, size_t count, variant_s *variants) {
+	variant_jobs_s j;
+	pthread_t *threads;
+	variant_s *v;
+	map_node_t i;
+	size_t n, started = 0;
+	j.cli = cli;
+	j.entries = entries;
+	j.count = count;
+	j.next = 0;
+	j.error = 0;
+	for(j.variant_count=0, v=variants; v; v=v->next, j.variant_count++) {
+		/* -D values are defaults of variants */
+		for(i=cli->vars ? map_begin(cli->vars) : 0; i; i=map_next(i)) {
+			if(!map_get(v->vars, i->key))
+				map_set(v->vars, i->key, i->value);
 			if(err())
 				return;
-			for(i=syntree_begin(st); i; i=syntree_next(i)) {
-				xcss_process_node(h, i, ns, fprefix, name_prefix, sout, serr);
-				if(err())
-					return;
-			}
 		}
 	}
+	j.variants = heap_alloc(cli->heap, j.variant_count*sizeof(variant_s *));
+	if(err())
+		return;
+	for(n=0, v=variants; v; v=v->next)
+		j.variants[n++] = v;
+	n = count*j.variant_count;
+	if(n>(size_t)cli->threads)
+		n = cli->threads;
+	threads = heap_alloc(cli->heap, n*sizeof(pthread_t));
+	if(err())
+		return;
+	pthread_mutex_init(&j.lock, 0);
+	for(; started<n; started++)
+		if(pthread_create(threads + started, 0, variant_worker, &j))
+			break;
+	if(!started)
+		variant_worker(&j);
+	while(started)
+		pthread_join(threads[--started], 0);
+	pthread_mutex_destroy(&j.lock);
+	if(j.error)
+		err_replace(j.error);
 }
 
+static void write_trace(const char *fname, FILE *serr) {
+	FILE *f = fopen(fname, "w");
+	if(!f) {
+		fprintf(serr, "Can't open trace file %s.\n", fname);
+		xcss_trace_stop();
+		return;
+	}
+	xcss_trace_write(f);
+	fclose(f);
+}
 
 int main(int nargs, char **args) {
-	str_t cnt;
 	heap_t h;
-	syntree_t st;
-	syntree_node_t i;
-	xcss_ns_t ns;
-	FILE *out;
-	char *file_name = 0;
-	out = stderr = stdout;
+	cli_s cli;
+	xcss_entry_t entries;
+	size_t count = 0, c;
+	const char *output = 0;
+	int list_includes = 0;
+	int emit_binary = 0;
+	variant_s *variants = 0;
+	int stats = 0;
+	int perf = 0;
+	xcss_stats_s stats_data;
+	const char *trace = 0;
+	FILE *serr = stderr;
+	int watch = 0;
+	const char *server = 0;
+	long workers = sysconf(_SC_NPROCESSORS_ONLN);
 	int a;
-	for(a=0; a<nargs; a++) {
+	stderr = stdout;
+	cli.stats = 0;
+	cli.source_map = 0;
+	cli.gzip = 0;
+	cli.shard = 0;
+	cli.used = 0;
+	cli.vars = 0;
+	cli.patch = 0;
+	cli.patches = 0;
+	h = heap_create(1024*64);
+	if(err())
+		return -1;
+	cli.heap = h;
+	entries = heap_alloc(h, nargs*sizeof(xcss_entry_s));
+	if(err())
+		goto error;
+	for(a=1; a<nargs; a++) {
 		if(strcmp(args[a], "-h")==0 || strcmp(args[a], "--help")==0) {
 			printf("XCSS processor\n");
 			printf("Arguments:\n");
 			printf("\t-h, --help     show this help and exit\n");
-			printf("\t-o             output file\n");
-			printf("\t-i             input file\n");
+			printf("\t-o             output file (of the preceding input file)\n");
+			printf("\t-i             input file, may be repeated\n");
+			printf("\t--list-includes  print included files without compiling\n");
+			printf("\t--emit-binary  write precompiled input.xcssb of every input file,\n");
+			printf("\t               includes use it instead of source while it is fresh\n");
+			printf("\t--watch        recompile input files when they or their includes change\n");
+			printf("\t--patch        with --watch, write classes added, changed and removed\n");
+			printf("\t               by every compile to out.css.patch.json\n");
+			printf("\t--server path  serve compile requests on unix socket\n");
+			printf("\t--workers n    number of server, parser and compression threads\n");
+			printf("\t--stats        print compilation statistics to stderr\n");
+			printf("\t--stats=json   print compilation statistics as JSON\n");
+			printf("\t--perf         add hardware counters of phases to statistics\n");
+			printf("\t--trace file   write Chrome trace events of compilation to file\n");
+			printf("\t--source-map   write source map of every output to output.map\n");
+			printf("\t--gzip         write gzip compressed copy of every output to output.gz\n");
+			printf("\t--used file    write only classes named in file (list or templates),\n");
+			printf("\t               may be repeated\n");
+			printf("\t--shard        write every top-level namespace to its own file\n");
+			printf("\t               (out.ns.css) with a manifest in out.css.manifest.json\n");
+			printf("\t-D name=value  set global variable, replacing its definitions in sources\n");
+			printf("\t--variants file  compile every input once per variant of file,\n");
+			printf("\t               name [ var: value; ... ], to out.name.css\n");
+			heap_delete(h);
 			return 0;
+		} else if(strcmp(args[a], "--list-includes")==0) {
+			list_includes = 1;
+		} else if(strcmp(args[a], "--emit-binary")==0) {
+			emit_binary = 1;
+		} else if(strcmp(args[a], "--stats")==0) {
+			stats = 1;
+		} else if(strcmp(args[a], "--stats=json")==0) {
+			stats = 2;
+		} else if(strcmp(args[a], "--trace")==0) {
+			if((a+1)>=nargs) {
+				fprintf(stderr, "Invalid argument. File name expected after --trace.\nUse --help option for more information.\n");
+				goto error;
+			}
+			trace = args[++a];
+		} else if(strcmp(args[a], "--source-map")==0) {
+			cli.source_map = 1;
+		} else if(strcmp(args[a], "--gzip")==0) {
+			cli.gzip = 1;
+		} else if(strcmp(args[a], "--used")==0) {
+			if((a+1)>=nargs) {
+				fprintf(stderr, "Invalid argument. File name expected after --used.\nUse --help option for more information.\n");
+				goto error;
+			}
+			read_used(&cli, args[++a]);
+			if(err())
+				goto error;
+		} else if(strcmp(args[a], "--shard")==0) {
+			cli.shard = 1;
+		} else if(strncmp(args[a], "-D", 2)==0) {
+			if(!args[a][2] && (a+1)>=nargs) {
+				fprintf(stderr, "Invalid argument. name=value expected after -D.\nUse --help option for more information.\n");
+				goto error;
+			}
+			add_define(&cli, args[a][2] ? args[a] + 2 : args[++a]);
+			if(err())
+				goto error;
+		} else if(strcmp(args[a], "--variants")==0) {
+			if((a+1)>=nargs) {
+				fprintf(stderr, "Invalid argument. File name expected after --variants.\nUse --help option for more information.\n");
+				goto error;
+			}
+			variants = read_variants(&cli, args[++a]);
+			if(err())
+				goto error;
+		} else if(strcmp(args[a], "--perf")==0) {
+			perf = 1;
+		} else if(strcmp(args[a], "--watch")==0) {
+			watch = 1;
+		} else if(strcmp(args[a], "--patch")==0) {
+			cli.patch = 1;
+		} else if(strcmp(args[a], "--server")==0) {
+			if((a+1)>=nargs) {
+				fprintf(stderr, "Invalid argument. Socket path expected after --server.\nUse --help option for more information.\n");
+				goto error;
+			}
+			server = args[++a];
+		} else if(strcmp(args[a], "--workers")==0) {
+			if((a+1)>=nargs || atol(args[a+1])<=0) {
+				fprintf(stderr, "Invalid argument. Number expected after --workers.\nUse --help option for more information.\n");
+				goto error;
+			}
+			workers = atol(args[++a]);
 		} else if(strcmp(args[a], "-o")==0) {
 			if((a+1)>=nargs) {
 				fprintf(stderr, "Invalid argument. File name expected after -o.\nUse --help option for more information.\n");
-				return -1;
+				goto error;
 			} else {
 				a++;
-				out = fopen(args[a], "w");
-				if(!out) {
-					fprintf(stderr, "Can\'t create output file \"%s\"", args[a]);
-					return -1;
-				}
+				if(count)
+					entries[count-1].output = args[a];
+				else
+					output = args[a];
 			}
 		} else if(strcmp(args[a], "-i")==0) {
 			if((a+1)>=nargs) {
 				fprintf(stderr, "Invalid argument. File name expected after -i.\nUse --help option for more information.\n");
-				return -1;
+				goto error;
 			} else {
 				a++;
-				file_name = args[a];
+				entries[count].input = str_from_cs(h, args[a]);
+				if(err())
+					goto error;
+				entries[count].output = 0;
+				entries[count].heap = 0;
+				entries[count].deps = 0;
+				count++;
 			}
 		}
 	}
-	h = heap_create(1024*64);
-	if(err())
+	if(!count) {
+		entries[0].input = 0;
+		entries[0].output = 0;
+		entries[0].heap = 0;
+		entries[0].deps = 0;
+		count = 1;
+	}
+	if(output && !entries[0].output)
+		entries[0].output = output;
+	if(emit_binary && !entries[0].input) {
+		fprintf(stderr, "Invalid argument. Input file expected for --emit-binary.\nUse --help option for more information.\n");
+		goto error;
+	}
+	if(variants && (!entries[0].input || list_includes || emit_binary || watch || server || stats || perf)) {
+		fprintf(stderr, "Invalid argument. --variants needs input files and can't be used with --list-includes, --emit-binary, --watch, --server and --stats.\nUse --help option for more information.\n");
+		goto error;
+	}
+	if(cli.patch && !watch) {
+		fprintf(stderr, "Invalid argument. --patch needs --watch.\nUse --help option for more information.\n");
+		goto error;
+	}
+	for(c=0; c<count && (cli.source_map || cli.gzip || cli.shard || variants || cli.patch) && !list_includes && !emit_binary; c++) {
+		if(!entries[c].output) {
+			fprintf(stderr, "Invalid argument. Output file expected for --source-map, --gzip, --shard, --variants and --patch.\nUse --help option for more information.\n");
+			goto error;
+		}
+	}
+	if(cli.shard && cli.source_map) {
+		fprintf(stderr, "Invalid argument. --source-map can't be used with --shard.\nUse --help option for more information.\n");
+		goto error;
+	}
+#ifndef XCSS_ZLIB
+	if(cli.gzip) {
+		fprintf(stderr, "Invalid argument. This build has no gzip support.\n");
 		goto error;
-	if(!file_name) {
-		cnt = read_stream(h, stdin);
+	}
+#endif
+	cli.cache = 0;
+	cli.stats = 0;
+	cli.serr = stderr;
+	cli.threads = workers;
+	if(trace)
+		xcss_trace_start(0);
+	if(server) {
+		cli.cache = xcss_cache_create(h, 1);
 		if(err())
 			goto error;
-	} else {
-		cnt = str_from_cs(h, file_name);
+		xcss_serve(server, workers, serve_request, &cli, stderr);
 		if(err())
+			fprintf(stderr, "%s\n", err_get()->message);
+		cli.cache = xcss_cache_delete(cli.cache);
+		goto error;
+	}
+	if(watch) {
+		if(!entries[0].input) {
+			fprintf(stderr, "Invalid argument. Input file expected for --watch.\nUse --help option for more information.\n");
 			goto error;
-		cnt = read_file(h, cnt);
+		}
+		cli.cache = xcss_cache_create(h, 0);
 		if(err())
 			goto error;
-	}
-	st = xcss_to_syntree(h, cnt);
-	if(err())
+		xcss_watch(h, cli.cache, entries, count, compile_entry, &cli, stderr);
+		if(err())
+			fprintf(stderr, "%s\n", err_get()->message);
+		cli.cache = xcss_cache_delete(cli.cache);
+		patches_delete(&cli);
 		goto error;
-	ns = ns_create(h, ns);
-	for(i=syntree_begin(st); i; i=syntree_next(i)) {
-		xcss_process_node(h, i, ns, 0, 0, out, stderr);
+	}
+	if(perf && !stats)
+		stats = 1;
+	if(stats) {
+		cli.stats = &stats_data;
+		xcss_stats_init(cli.stats);
+		if(perf && !xcss_stats_perf(cli.stats))
+			fprintf(serr, "Hardware counters are not available, only time is measured.\n");
+	}
+	if(variants) {
+		cli.cache = xcss_cache_create(h, 0);
+		if(err())
+			goto error;
+		compile_variants(&cli, entries, count, variants);
+		cli.cache = xcss_cache_delete(cli.cache);
 		if(err())
 			goto error;
 	}
+	for(c=0; c<count && !variants; c++) {
+		if(list_includes)
+			list_entry(h, entries + c);
+		else if(emit_binary)
+			emit_entry(&cli, entries + c);
+		else
+			compile_entry(&cli, entries + c);
+		if(err())
+			goto error;
+	}
+	if(stats == 1)
+		xcss_stats_write(cli.stats, h, serr);
+	else if(stats == 2)
+		xcss_stats_write_json(cli.stats, h, serr);
+	if(cli.stats)
+		xcss_stats_close(cli.stats);
+	if(trace)
+		write_trace(trace, serr);
 	h = heap_delete(h);
-	if(out!=stdout)
-		fclose(out);
 	return 0;
 error:
 	err_reset();
+	if(cli.stats)
+		xcss_stats_close(cli.stats);
+	if(trace)
+		write_trace(trace, serr);
 	heap_delete(h);
 	return -1;
 }
-
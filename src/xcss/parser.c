@@ -1,5 +1,6 @@
 
 #include "parser.h"
+#include <pthread.h>
 
 #define p_skip(i, e, ex) \
 while((i)<(e) && (ex))   \
@@ -22,6 +23,9 @@ static xcss_node_type_t get_node_type(str_it_t i, str_it_t e) {
 						return XCSS_NODE_RULE;
 					else if(*i=='{')
 						return XCSS_NODE_CLASS;
+					else if(*i=='$' && (e-i)>=2 && i[1]=='{')
+						/* ${name} in value of variable */
+						for(i+=2; i<e && *i!='}'; i++);
 				}
 				break;
 			case '[':
@@ -55,37 +59,115 @@ static void parse_node_name(syntree_t st) {
 	}
 }
 
-static void parse_node_value(syntree_t st) {
-	str_it_t i, e;
-	i = syntree_position(st);
-	e = str_end(syntree_str(st));
-	syntree_named_start(st, XCSS_NODE_VALUE);
+#define is_var(i, e) ((e-i)>=2 ? i[0]=='$' && i[1]=='{' : 0)
+
+/**
+ * Closing parenthesis of calc( starting at i, zero if i is not calc(
+ * or it isn't closed before end of rule.
+ */
+static str_it_t calc_end(str_it_t begin, str_it_t i, str_it_t e) {
+	int level = 1;
+	if((e-i)<5 || memcmp(i, "calc(", 5))
+		return 0;
+	/* part of other function name, like -webkit-calc( */
+	if(i>begin && (isalnum(i[-1]) || i[-1]=='-' || i[-1]=='_'))
+		return 0;
+	for(i+=5; i<e && *i!=';'; i++) {
+		if(*i=='(')
+			level++;
+		else if(*i==')' && !--level)
+			return i;
+	}
+	return 0;
+}
+
+/**
+ * End of string or url() token starting at i, zero if there is none there.
+ * Their text is kept as it is, calc( in them is not folded.
+ */
+static str_it_t literal_end(str_it_t begin, str_it_t i, str_it_t stop) {
+	str_it_t j;
+	if(*i=='"' || *i=='\'') {
+		for(j=i+1; j<stop && *j!=*i; j++)
+			if(*j=='\\' && j+1<stop)
+				j++;
+		return j<stop ? j+1 : stop;
+	}
+	if((stop-i)<4 || memcmp(i, "url(", 4))
+		return 0;
+	if(i>begin && (isalnum(i[-1]) || i[-1]=='-' || i[-1]=='_'))
+		return 0;
+	j = memchr(i+4, ')', stop-i-4);
+	return j ? j+1 : stop;
+}
+
+static void parse_node_var(syntree_t st, str_it_t i, str_it_t e) {
+	syntree_seek(st, i+2);
+	parse_node_name(st);
 	if(err())
 		return;
-	while(i<e ? *i!=';' : 0) {
-		if((e-i)>=2 ? i[0]=='$' && i[1]=='{' : 0) {
-			syntree_seek(st, i+2);
-			parse_node_name(st);
+	i = syntree_position(st);
+	if(i<e ? *i!='}' : 1) {
+		err_set(e_xcss_syntax);
+		return;
+	}
+	syntree_seek(st, i+1);
+}
+
+/**
+ * Text and variables up to stop (end of rule or of calc expression).
+ */
+static void parse_value_parts(syntree_t st, str_it_t stop, int calc) {
+	str_it_t begin = syntree_position(st), i = begin, e = str_end(syntree_str(st)), ce, le;
+	/* end of string or url() being parsed, variables are still found in them */
+	str_it_t literal = begin;
+	while(i<stop) {
+		if(calc && i>=literal && (le = literal_end(begin, i, stop)))
+			literal = le;
+		if(is_var(i, e)) {
+			parse_node_var(st, i, e);
+			if(err())
+				return;
 			i = syntree_position(st);
-			if(i<e ? *i!='}' : 1) {
-				err_set(e_xcss_syntax);
+		} else if(calc && i>=literal && (ce = calc_end(begin, i, stop))) {
+			syntree_seek(st, i+5);
+			syntree_named_start(st, XCSS_NODE_CALC);
+			if(err())
 				return;
-			}
-			i++;
-			syntree_seek(st, i);
+			parse_value_parts(st, ce, 0);
+			if(err())
+				return;
+			syntree_named_end(st);
+			syntree_seek(st, ce+1);
+			i = ce+1;
 		} else {
 			syntree_named_start(st, XCSS_NODE_TEXT);
 			if(err())
 				return;
-			while(i<e && *i!=';') {
+			while(i<stop) {
 				i++;
-				if((e-i)>=2 ? i[0]=='$' && i[1]=='{' : 0)
+				if(calc && i<stop && i>=literal && (le = literal_end(begin, i, stop)))
+					literal = le;
+				if(is_var(i, e) || (calc && i<stop && i>=literal && calc_end(begin, i, stop)))
 					break;
 			}
 			syntree_seek(st, i);
 			syntree_named_end(st);
 		}
 	}
+}
+
+static void parse_node_value(syntree_t st) {
+	str_it_t i, e;
+	i = syntree_position(st);
+	e = str_end(syntree_str(st));
+	syntree_named_start(st, XCSS_NODE_VALUE);
+	if(err())
+		return;
+	p_skip(i, e, *i!=';');
+	parse_value_parts(st, i, 1);
+	if(err())
+		return;
 	if(i==e) {
 		err_set(e_xcss_syntax);
 	} else {
@@ -198,8 +280,69 @@ error:
 	return;
 }
 
+/**
+ * Rules of class body from position up to closing brace.
+ */
+static void parse_class_rules(syntree_t st) {
+	str_it_t i = syntree_position(st), e = str_end(syntree_str(st));
+	while(i<e) {
+		p_skip_spaces(i, e);
+		if(i==e)
+			break;
+		syntree_seek(st, i);
+		if(*i=='/')
+			parse_node_comment(st);
+		else if(*i=='}') {
+			syntree_seek(st, i+1);
+			return;
+		} else {
+			syntree_named_start(st, XCSS_NODE_RULE);
+			if(err())
+				return;
+			parse_node_rule(st);
+			if(err())
+				return;
+			syntree_named_end(st);
+			if(err())
+				return;
+		}
+		i = syntree_position(st);
+	}
+	syntree_seek(st, i);
+	err_set(e_xcss_syntax);
+}
+
+/**
+ * Closing brace of class body, found the way parse_class_rules would
+ * walk it: comments are skipped and rules end with ';'. Zero if
+ * body is not closed.
+ */
+static str_it_t body_end(str_it_t i, str_it_t e) {
+	while(i<e) {
+		p_skip_spaces(i, e);
+		if(i==e)
+			break;
+		if(*i=='}')
+			return i;
+		if(*i=='/') {
+			if((e-i)<2 || i[1]!='*')
+				return 0;
+			for(i+=2; (e-i)>=2 && (i[0]!='*' || i[1]!='/'); i++);
+			if((e-i)<2)
+				return 0;
+			i += 2;
+		} else {
+			i = memchr(i, ';', e - i);
+			if(!i)
+				return 0;
+			i++;
+		}
+	}
+	return 0;
+}
+
 static void parse_node_class(syntree_t st) {
-	str_it_t i, e;
+	str_it_t i, e, be;
 	i = syntree_position(st);
 	e = str_end(syntree_str(st));
 	p_skip_spaces(i, e);
@@ -221,30 +364,22 @@ static void parse_node_class(syntree_t st) {
 			goto error;
 	}
 	if(*i=='{') {
+		/* rules are parsed when class is evaluated, most of vendor
+		   classes never are */
 		i++;
-		while(i<e) {
-			p_skip_spaces(i, e);
-			if(i==e)
-				goto error;
-			syntree_seek(st, i);
-			if(*i=='/')
-				parse_node_comment(st);
-			else if(*i=='}') {
-				syntree_seek(st, i+1);
-				return;
-			} else {
-				syntree_named_start(st, XCSS_NODE_RULE);
-				if(err())
-					return;
-				parse_node_rule(st);
-				if(err())
-					return;
-				syntree_named_end(st);
-				if(err())
-					return;
-			}
-			i = syntree_position(st);
-		}
+		be = body_end(i, e);
+		if(!be)
+			goto error;
+		syntree_seek(st, i);
+		syntree_named_start(st, XCSS_NODE_BODY);
+		if(err())
+			return;
+		syntree_seek(st, be);
+		syntree_named_end(st);
+		if(err())
+			return;
+		syntree_seek(st, be+1);
+		return;
 	}
 error:
 	syntree_seek(st, i);
@@ -408,18 +543,198 @@ static void xcss_parse(syntree_t res) {
 }
 
 
-syntree_t xcss_to_syntree(heap_t h, str_t xcss) {
-	str_it_t i, e;
+/**
+ * Top-level statements starting before end, the last one may end after it.
+ */
+static void parse_until(syntree_t st, str_it_t end) {
+	while(syntree_position(st)<end) {
+		xcss_parse(st);
+		if(err())
+			return;
+	}
+}
+
+syntree_t xcss_to_syntree_ex(heap_t h, str_t xcss, str_it_t *error) {
 	syntree_t res = syntree_create(h, xcss);
 	if(err())
 		return 0;
-	e = str_end(xcss);
-	while(syntree_position(res)!=e) {
-		xcss_parse(res);
+	parse_until(res, str_end(xcss));
+	if(err()) {
+		if(error)
+			*error = syntree_position(res);
+		return 0;
+	}
+	return res;
+}
+
+/**
+ * Cut input to n parts of about the same size at ends of top-level
+ * statements: after ';', '}', ']' or comment at depth zero, outside of
+ * comments and quotes. Returns number of parts, cuts[0] is the beginning.
+ * The scan does not know the grammar, so cuts are only guesses.
+ */
+static int split_input(str_it_t i, str_it_t e, str_it_t *cuts, int n) {
+	str_it_t target;
+	int depth = 0, k = 1, cut;
+	char q;
+	cuts[0] = i;
+	target = i + (e - i)/n;
+	while(i<e && k<n) {
+		cut = 0;
+		switch(*i++) {
+			case '{':
+			case '[':
+				depth++;
+				break;
+			case '}':
+			case ']':
+				if(depth)
+					depth--;
+				cut = !depth;
+				break;
+			case ';':
+				cut = !depth;
+				break;
+			case '/':
+				if(i<e && *i=='*') {
+					for(i++; (e-i)>=2 && (i[0]!='*' || i[1]!='/'); i++);
+					if((e-i)<2)
+						return k;
+					i += 2;
+					cut = !depth;
+				}
+				break;
+			case '"':
+			case '\'':
+				/* quotes do not span lines, so a stray one is forgotten soon */
+				for(q=i[-1]; i<e && *i!=q && *i!='\n'; i++);
+				if(i<e && *i==q)
+					i++;
+				break;
+		}
+		if(cut && i>=target && i<e) {
+			cuts[k++] = i;
+			target = i + (e - i)/(n - k + 1);
+		}
+	}
+	return k;
+}
+
+typedef struct {
+	syntree_t st;
+	str_it_t end;
+	const err_t *error;
+	str_it_t error_position;
+	pthread_t thread;
+	int started;
+} parse_part_s;
+
+static void *parse_part(void *data) {
+	parse_part_s *p = data;
+	parse_until(p->st, p->end);
+	p->error = err_get();
+	p->error_position = syntree_position(p->st);
+	err_clear();
+	return 0;
+}
+
+static void heap_free(void *h) {
+	heap_delete(h);
+}
+
+syntree_t xcss_to_syntree_parallel(heap_t h, str_t xcss, int threads, str_it_t *error) {
+	str_it_t b = str_begin(xcss), e = str_end(xcss), cuts[XCSS_PARSE_THREADS_MAX];
+	parse_part_s parts[XCSS_PARSE_THREADS_MAX];
+	syntree_t res;
+	heap_t ph;
+	int n, k;
+	if((size_t)threads>str_length(xcss)/XCSS_PARSE_PART_MIN)
+		threads = str_length(xcss)/XCSS_PARSE_PART_MIN;
+	if(threads>XCSS_PARSE_THREADS_MAX)
+		threads = XCSS_PARSE_THREADS_MAX;
+	n = threads>1 ? split_input(b, e, cuts, threads) : 1;
+	if(n<2)
+		return xcss_to_syntree_ex(h, xcss, error);
+	res = syntree_create(h, xcss);
+	if(err())
+		return 0;
+	/* parts are parsed to heaps of their own, deleted with h */
+	for(k=1; k<n; k++) {
+		parts[k].started = 0;
+		parts[k].error = 0;
+		ph = heap_create(0);
 		if(err())
-			return 0;
+			goto join;
+		heap_on_delete(h, heap_free, ph);
+		if(err()) {
+			heap_delete(ph);
+			goto join;
+		}
+		parts[k].st = syntree_create(ph, xcss);
+		if(err())
+			goto join;
+		syntree_seek(parts[k].st, cuts[k]);
+		parts[k].end = k + 1<n ? cuts[k + 1] : e;
+		parts[k].started = !pthread_create(&parts[k].thread, 0, parse_part, parts + k);
+		if(!parts[k].started)
+			parse_part(parts + k);
+	}
+	parse_until(res, cuts[1]);
+join:
+	for(; k>1; k--)
+		if(parts[k - 1].started)
+			pthread_join(parts[k - 1].thread, 0);
+	if(err())
+		goto error;
+	/* part is taken if the previous one ended where it begins, otherwise
+	   the cut was wrong and its statements are parsed again */
+	for(k=1; k<n; k++) {
+		if(syntree_position(res)==cuts[k]) {
+			if(parts[k].error) {
+				syntree_seek(res, parts[k].error_position);
+				err_replace(parts[k].error);
+				goto error;
+			}
+			if(parts[k].st->first) {
+				if(res->last)
+					res->last->next = parts[k].st->first;
+				else
+					res->first = parts[k].st->first;
+				res->last = parts[k].st->last;
+			}
+			syntree_seek(res, syntree_position(parts[k].st));
+		} else {
+			parse_until(res, parts[k].end);
+			if(err())
+				goto error;
+		}
 	}
 	return res;
+error:
+	if(error)
+		*error = syntree_position(res);
+	return 0;
+}
+
+syntree_node_t xcss_parse_body(heap_t h, str_t source, syntree_node_t body, str_it_t *error) {
+	/* called for every class, only nodes are kept */
+	struct syntree_s res;
+	res.heap = h;
+	res.first = res.last = 0;
+	res.parent = 0;
+	res.str = source;
+	res.position = res.max_position = body->position;
+	parse_class_rules(&res);
+	if(err()) {
+		if(error)
+			*error = syntree_position(&res);
+		return 0;
+	}
+	return syntree_begin(&res);
+}
+
+syntree_t xcss_to_syntree(heap_t h, str_t xcss) {
+	return xcss_to_syntree_ex(h, xcss, 0);
 }
 
 
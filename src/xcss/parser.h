@@ -8,21 +8,43 @@
 
 ERR_DECLARE(e_xcss_syntax);
 
+#define XCSS_PARSE_THREADS_MAX 64
+#define XCSS_PARSE_PART_MIN (1024*1024)
+
 typedef enum {
 	XCSS_NODE_NAME = 1,
 	XCSS_NODE_NAMESPACE = 2,
-	XCSS_NODE_CLASS = 3, /* CLASS_NAME ("(" (XCSS_NODE_CLASS_NAME ",")+ ")")? { RULE* } */
+	XCSS_NODE_CLASS = 3, /* CLASS_NAME ("(" (XCSS_NODE_CLASS_NAME ",")+ ")")? "{" BODY "}" */
 	XCSS_NODE_CLASS_NAME = 4,
 	XCSS_NODE_CLASS_PARENT = 5, /* "(" (XCSS_NODE_CLASS_NAME ",")+ ")" */
 	XCSS_NODE_RULE = 6, /* NAME ":" VALUE ";" */
-	XCSS_NODE_VALUE = 7, /* (TEXT|NAME)* */
+	XCSS_NODE_VALUE = 7, /* (TEXT|NAME|CALC)* */
 	XCSS_NODE_TEXT = 8,
 	XCSS_NODE_INCLUDE = 9,
 	XCSS_NODE_INCLUDE_NAME = 10,
-	XCSS_NODE_COMMENT = 11
+	XCSS_NODE_COMMENT = 11,
+	XCSS_NODE_CALC = 12, /* "calc(" (TEXT|NAME)* ")", node is the expression inside */
+	XCSS_NODE_BODY = 13 /* RULE*, left unparsed until xcss_parse_body */
 } xcss_node_type_t;
 
 syntree_t xcss_to_syntree(heap_t, str_t);
+/**
+ * On e_xcss_syntax, position where parsing stopped is stored to *error.
+ */
+syntree_t xcss_to_syntree_ex(heap_t, str_t, str_it_t *error);
+/**
+ * Same tree as of xcss_to_syntree_ex, parsed by up to threads threads.
+ * Input is cut at top-level statements to parts of at least
+ * XCSS_PARSE_PART_MIN bytes, parts are parsed to separate heaps
+ * (deleted with the heap) and joined in order.
+ */
+syntree_t xcss_to_syntree_parallel(heap_t, str_t, int threads, str_it_t *error);
+/**
+ * Parse rules of class body, returns the first one. Source is the string
+ * body was found in, so positions of rules point to it. Errors are
+ * reported as by xcss_to_syntree_ex.
+ */
+syntree_node_t xcss_parse_body(heap_t, str_t source, syntree_node_t body, str_it_t *error);
 
 
 #endif /* MAY_PARSER_H */
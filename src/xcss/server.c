@@ -0,0 +1,209 @@
+#include "server.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+ERR_DEFINE(e_xcss_server, "Can't start server.", 0);
+
+#define SERVER_HEADER_SIZE 5
+
+typedef struct {
+	int fd;
+	xcss_request_f f;
+	void *data;
+} server_s;
+
+static int read_all(int fd, void *buf, size_t sz) {
+	char *p = buf;
+	while(sz) {
+		ssize_t r = read(fd, p, sz);
+		if(r<0 && errno==EINTR)
+			continue;
+		if(r<=0)
+			return 0;
+		p += r;
+		sz -= r;
+	}
+	return 1;
+}
+
+static int write_all(int fd, const void *buf, size_t sz) {
+	const char *p = buf;
+	while(sz) {
+		ssize_t r = send(fd, p, sz, MSG_NOSIGNAL);
+		if(r<0 && errno==EINTR)
+			continue;
+		if(r<=0)
+			return 0;
+		p += r;
+		sz -= r;
+	}
+	return 1;
+}
+
+static size_t get_length(const unsigned char *p) {
+	return ((size_t)p[0]<<24) | ((size_t)p[1]<<16) | ((size_t)p[2]<<8) | p[3];
+}
+
+/**
+ * Split data of request with options to options and the rest.
+ */
+static str_t split_options(heap_t h, str_t *data) {
+	str_it_t b = str_begin(*data), e = str_end(*data);
+	str_t r;
+	size_t len;
+	if(e - b<4 || (len = get_length((const unsigned char *)b))>(size_t)(e - b - 4)) {
+		err_set(e_arguments);
+		return 0;
+	}
+	r = str_interval(h, b + 4, b + 4 + len);
+	if(err())
+		return 0;
+	*data = str_interval(h, b + 4 + len, e);
+	return err() ? 0 : r;
+}
+
+static int write_response(int fd, char status, const char *data, size_t sz) {
+	unsigned char hdr[SERVER_HEADER_SIZE];
+	hdr[0] = status;
+	hdr[1] = (sz>>24) & 0xFF;
+	hdr[2] = (sz>>16) & 0xFF;
+	hdr[3] = (sz>>8) & 0xFF;
+	hdr[4] = sz & 0xFF;
+	return write_all(fd, hdr, SERVER_HEADER_SIZE) && write_all(fd, data, sz);
+}
+
+static void serve_connection(server_s *s, heap_t h, int fd) {
+	while(1) {
+		unsigned char hdr[SERVER_HEADER_SIZE];
+		size_t len, olen = 0, elen = 0;
+		char *obuf = 0, *ebuf = 0;
+		FILE *sout, *serr;
+		str_t data, options = 0;
+		int ok;
+		if(!read_all(fd, hdr, SERVER_HEADER_SIZE))
+			return;
+		len = get_length(hdr + 1);
+		if(len>XCSS_SERVER_REQUEST_MAX) {
+			static const char msg[] = "Request is too large.\n";
+			/* data is not read, so the connection can't go on */
+			write_response(fd, 'e', msg, sizeof(msg) - 1);
+			return;
+		}
+		heap_reset(h);
+		data = str_create(h, len);
+		if(err()) {
+			err_clear();
+			return;
+		}
+		if(!read_all(fd, str_begin(data), len))
+			return;
+		sout = open_memstream(&obuf, &olen);
+		serr = open_memstream(&ebuf, &elen);
+		if(!sout || !serr) {
+			if(sout)
+				fclose(sout);
+			if(serr)
+				fclose(serr);
+			return;
+		}
+		if(hdr[0]=='F' || hdr[0]=='S') {
+			options = split_options(h, &data);
+			if(err())
+				fprintf(serr, "Invalid options of request.\n");
+		}
+		if(!err()) {
+			if(hdr[0]=='f' || hdr[0]=='F')
+				s->f(s->data, h, data, 0, options, sout, serr);
+			else if(hdr[0]=='s' || hdr[0]=='S')
+				s->f(s->data, h, 0, data, options, sout, serr);
+			else {
+				fprintf(serr, "Unknown request.\n");
+				err_set(e_arguments);
+			}
+		}
+		ok = !err();
+		err_clear();
+		fclose(sout);
+		fclose(serr);
+		ok = ok ? write_response(fd, 'o', obuf, olen) : write_response(fd, 'e', ebuf, elen);
+		free(obuf);
+		free(ebuf);
+		if(!ok)
+			return;
+	}
+}
+
+static void *worker(void *data) {
+	server_s *s = data;
+	heap_t h = heap_create(0);
+	if(err()) {
+		err_clear();
+		return 0;
+	}
+	while(1) {
+		int fd = accept(s->fd, 0, 0);
+		if(fd<0) {
+			if(errno==EINTR || errno==ECONNABORTED)
+				continue;
+			break;
+		}
+		serve_connection(s, h, fd);
+		close(fd);
+	}
+	heap_delete(h);
+	return 0;
+}
+
+void xcss_serve(const char *path, int workers, xcss_request_f f, void *data, FILE *serr) {
+	struct sockaddr_un addr;
+	server_s s;
+	pthread_t *threads;
+	int i;
+	if(strlen(path)>=sizeof(addr.sun_path)) {
+		fprintf(serr, "Socket path \"%s\" is too long.\n", path);
+		err_set(e_xcss_server);
+		return;
+	}
+	s.f = f;
+	s.data = data;
+	s.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(s.fd<0) {
+		err_set(e_xcss_server);
+		return;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if(bind(s.fd, (struct sockaddr *)&addr, sizeof(addr))<0 || listen(s.fd, 64)<0) {
+		fprintf(serr, "Can't listen on \"%s\".\n", path);
+		close(s.fd);
+		err_set(e_xcss_server);
+		return;
+	}
+	if(workers<1)
+		workers = 1;
+	threads = mem_alloc(workers*sizeof(pthread_t));
+	if(err()) {
+		close(s.fd);
+		return;
+	}
+	for(i=0; i<workers; i++) {
+		if(pthread_create(threads + i, 0, worker, &s)) {
+			err_set(e_xcss_server);
+			break;
+		}
+	}
+	if(err())
+		shutdown(s.fd, SHUT_RDWR);
+	while(i--)
+		pthread_join(threads[i], 0);
+	mem_free(threads);
+	close(s.fd);
+	unlink(path);
+}
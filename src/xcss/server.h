@@ -0,0 +1,34 @@
+#ifndef MAY_SERVER_H
+#define MAY_SERVER_H
+
+#include "maylib/err.h"
+#include "maylib/heap.h"
+#include "maylib/str.h"
+#include <stdio.h>
+
+ERR_DECLARE(e_xcss_server);
+
+/**
+ * Longer requests are answered with error and connection is closed.
+ */
+#define XCSS_SERVER_REQUEST_MAX (64*1024*1024)
+
+/**
+ * Compile file name or source text (one of them is zero) with options
+ * of request (zero if there are none).
+ * Heap is reset after each request. Errors must be reported to serr.
+ */
+typedef void (*xcss_request_f)(void *, heap_t, str_t fname, str_t source, str_t options, FILE *sout, FILE *serr);
+
+/**
+ * Serve compile requests on unix socket with a pool of worker threads.
+ * A connection may send any number of requests, one after another.
+ * Request:  kind (1 byte, 'f' - file name, 's' - source), length (4 bytes, big-endian), data.
+ *           Kinds 'F' and 'S' are the same with options: data starts with
+ *           their length (4 bytes, big-endian) and text, followed by name or source.
+ * Response: status (1 byte, 'o' - ok, 'e' - error), length (4 bytes, big-endian), CSS or error messages.
+ * Returns on socket failure only.
+ */
+void xcss_serve(const char *path, int workers, xcss_request_f, void *, FILE *serr);
+
+#endif /* MAY_SERVER_H */
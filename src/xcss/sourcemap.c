@@ -0,0 +1,231 @@
+#include "sourcemap.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static void out_flush(xcss_smap_t m) {
+	if(m->out_used) {
+		m->write(m->write_data, m->out, m->out_used);
+		m->out_used = 0;
+	}
+}
+
+static void out_write(xcss_smap_t m, const char *data, size_t sz) {
+	if(m->out_used + sz > XCSS_SMAP_BUFFER_SIZE) {
+		out_flush(m);
+		if(sz>XCSS_SMAP_BUFFER_SIZE) {
+			m->write(m->write_data, data, sz);
+			return;
+		}
+	}
+	memcpy(m->out + m->out_used, data, sz);
+	m->out_used += sz;
+}
+
+#define out_cs(m, s) out_write((m), (s), sizeof(s) - 1)
+
+static void out_char(xcss_smap_t m, char c) {
+	if(m->out_used==XCSS_SMAP_BUFFER_SIZE)
+		out_flush(m);
+	m->out[m->out_used++] = c;
+}
+
+static void out_json(xcss_smap_t m, str_t s) {
+	const char *i, *e = str_end(s);
+	out_char(m, '"');
+	for(i=str_begin(s); i<e; i++) {
+		unsigned char c = *i;
+		if(c=='"' || c=='\\') {
+			out_char(m, '\\');
+			out_char(m, c);
+		} else if(c<0x20) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			out_write(m, buf, 6);
+		} else
+			out_char(m, c);
+	}
+	out_char(m, '"');
+}
+
+/**
+ * Sign goes to the lowest bit, then 5 bits per digit, lowest first.
+ */
+static void out_vlq(xcss_smap_t m, long v) {
+	unsigned long u = v<0 ? ((unsigned long)-v<<1) | 1 : (unsigned long)v<<1;
+	do {
+		unsigned d = u & 31;
+		u >>= 5;
+		if(u)
+			d |= 32;
+		out_char(m, base64[d]);
+	} while(u);
+}
+
+/* characters, not bytes, as UTF-8 continuation bytes are skipped */
+static size_t columns(const char *s, const char *e) {
+	size_t r = 0;
+	for(; s<e; s++)
+		r += (*s & 0xC0)!=0x80;
+	return r;
+}
+
+xcss_smap_t xcss_smap_create(heap_t h, str_t file, str_t root, xcss_smap_write_f f, void *data) {
+	xcss_smap_t r = heap_alloc(h, sizeof(xcss_smap_s));
+	if(err())
+		return 0;
+	r->heap = h;
+	r->write = f;
+	r->write_data = data;
+	r->out = heap_alloc(h, XCSS_SMAP_BUFFER_SIZE);
+	if(err())
+		return 0;
+	r->out_used = 0;
+	r->file = file;
+	r->root = root;
+	r->line = r->column = 0;
+	r->mapped_line = 0;
+	memset(r->prev, 0, sizeof(r->prev));
+	r->line_empty = 1;
+	r->count = 0;
+	r->sources = r->first_used = r->last_used = 0;
+	out_cs(r, "{\"version\":3,");
+	if(file) {
+		out_cs(r, "\"file\":");
+		out_json(r, file);
+		out_cs(r, ",");
+	}
+	if(root) {
+		out_cs(r, "\"sourceRoot\":");
+		out_json(r, root);
+		out_cs(r, ",");
+	}
+	out_cs(r, "\"mappings\":\"");
+	return r;
+}
+
+xcss_smap_source_t xcss_smap_source(xcss_smap_t m, str_t name, str_t content) {
+	xcss_smap_source_t r;
+	for(r=m->sources; r; r=r->next)
+		if(str_begin(r->content)==str_begin(content))
+			return r;
+	r = heap_alloc(m->heap, sizeof(xcss_smap_source_s));
+	if(err())
+		return 0;
+	r->name = name;
+	r->content = content;
+	r->lines = 0;
+	r->offset = r->line = r->column = 0;
+	r->index = -1;
+	r->next_used = 0;
+	r->next = m->sources;
+	m->sources = r;
+	return r;
+}
+
+void xcss_smap_output(xcss_smap_t m, const char *s, size_t sz) {
+	const char *i, *e = s + sz;
+	/* output comes in short pieces, most of them without newlines */
+	for(i=e; i>s && i[-1]!='\n'; i--);
+	if(i>s) {
+		m->line += xcss_count_newlines(s, i - s);
+		m->column = 0;
+	}
+	m->column += columns(i, e);
+}
+
+/**
+ * Files included several times are separate sources with the same name,
+ * they share the index.
+ */
+static void source_use(xcss_smap_t m, xcss_smap_source_t s) {
+	xcss_smap_source_t i;
+	for(i=m->first_used; i; i=i->next_used) {
+		if(i->name && s->name ? str_equal(i->name, s->name) : i->name==s->name) {
+			s->index = i->index;
+			return;
+		}
+	}
+	s->index = m->count++;
+	if(m->last_used)
+		m->last_used = m->last_used->next_used = s;
+	else
+		m->first_used = m->last_used = s;
+}
+
+/**
+ * Classes are mostly written in source order, so position is found by
+ * scanning forward from the previous one. Inherited rules jump back
+ * and use the line index.
+ */
+static void source_position(xcss_smap_t m, xcss_smap_source_t s, size_t offset) {
+	const char *i, *e, *b = str_begin(s->content);
+	size_t n;
+	if(offset<s->offset) {
+		if(!s->lines) {
+			s->lines = xcss_lines_create(m->heap, s->content);
+			if(err())
+				return;
+		}
+		xcss_lines_find(s->lines, offset, &s->line, &s->column);
+		s->line--;
+		s->column--;
+		s->offset = offset;
+		return;
+	}
+	i = b + s->offset;
+	e = b + offset;
+	n = xcss_count_newlines(i, e - i);
+	if(n) {
+		const char *nl = e - 1;
+		for(; *nl!='\n'; nl--);
+		s->line += n;
+		s->column = columns(nl + 1, e);
+	} else
+		s->column += columns(i, e);
+	s->offset = offset;
+}
+
+void xcss_smap_add(xcss_smap_t m, xcss_smap_source_t s, str_it_t position) {
+	long f[4];
+	int i;
+	if(!s || !position)
+		return;
+	if(s->index<0)
+		source_use(m, s);
+	source_position(m, s, position - str_begin(s->content));
+	if(err())
+		return;
+	for(; m->mapped_line<m->line; m->mapped_line++) {
+		out_char(m, ';');
+		m->line_empty = 1;
+		m->prev[0] = 0;
+	}
+	if(!m->line_empty)
+		out_char(m, ',');
+	m->line_empty = 0;
+	f[0] = m->column;
+	f[1] = s->index;
+	f[2] = s->line;
+	f[3] = s->column;
+	for(i=0; i<4; i++) {
+		out_vlq(m, f[i] - m->prev[i]);
+		m->prev[i] = f[i];
+	}
+}
+
+void xcss_smap_end(xcss_smap_t m) {
+	xcss_smap_source_t i;
+	out_cs(m, "\",\"sources\":[");
+	for(i=m->first_used; i; i=i->next_used) {
+		if(i!=m->first_used)
+			out_cs(m, ",");
+		if(i->name)
+			out_json(m, i->name);
+		else
+			out_cs(m, "\"<input>\"");
+	}
+	out_cs(m, "],\"names\":[]}\n");
+	out_flush(m);
+}
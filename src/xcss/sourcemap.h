@@ -0,0 +1,73 @@
+#ifndef MAY_SOURCEMAP_H
+#define MAY_SOURCEMAP_H
+
+#include "maylib/err.h"
+#include "maylib/heap.h"
+#include "maylib/str.h"
+#include "lines.h"
+
+#define XCSS_SMAP_BUFFER_SIZE (1024*16)
+
+typedef void (*xcss_smap_write_f)(void *, const char *, size_t);
+
+typedef struct xcss_smap_source_ss {
+	str_t name;
+	str_t content;
+	xcss_lines_t lines;     /* built on first backward jump */
+	size_t offset;          /* last mapped position, to scan forward from */
+	size_t line;
+	size_t column;
+	long index;             /* in "sources", -1 until first mapping */
+	struct xcss_smap_source_ss *next;
+	struct xcss_smap_source_ss *next_used;
+} xcss_smap_source_s;
+
+typedef xcss_smap_source_s *xcss_smap_source_t;
+
+typedef struct xcss_smap_ss {
+	heap_t heap;
+	xcss_smap_write_f write;
+	void *write_data;
+	char *out;
+	size_t out_used;
+	str_t file;
+	str_t root;
+	size_t line;            /* generated position */
+	size_t column;
+	size_t mapped_line;     /* generated line of the last segment */
+	long prev[4];           /* previous segment fields, mappings are relative */
+	int line_empty;
+	long count;             /* sources in "sources" */
+	xcss_smap_source_t sources;
+	xcss_smap_source_t first_used;
+	xcss_smap_source_t last_used;
+} xcss_smap_s;
+
+typedef xcss_smap_s *xcss_smap_t;
+
+/**
+ * Source map v3 writer. Segments are VLQ-encoded as output is generated
+ * and written through a small buffer, the list of sources is written
+ * at the end, so the map is never kept in memory.
+ * File is the name of generated file and root is "sourceRoot", both may be zero.
+ */
+xcss_smap_t xcss_smap_create(heap_t, str_t file, str_t root, xcss_smap_write_f, void *);
+/**
+ * Source for content of named file. Sources are searched by content,
+ * so it is cheap to call it every time a file is entered.
+ */
+xcss_smap_source_t xcss_smap_source(xcss_smap_t, str_t name, str_t content);
+/**
+ * Advance generated position over output text.
+ */
+void xcss_smap_output(xcss_smap_t, const char *, size_t);
+/**
+ * Map current generated position to position in source.
+ */
+void xcss_smap_add(xcss_smap_t, xcss_smap_source_t, str_it_t position);
+/**
+ * Write the rest of the map and flush it.
+ */
+void xcss_smap_end(xcss_smap_t);
+
+#endif /* MAY_SOURCEMAP_H */
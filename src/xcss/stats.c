@@ -0,0 +1,253 @@
+#include "stats.h"
+#include <string.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const char *phase_names[XCSS_PHASE_COUNT] = {
+	"idle", "read", "parse", "evaluate", "output"
+};
+
+static const char *perf_names[XCSS_PERF_COUNT] = {
+	"cycles", "instructions", "cache_misses", "branch_misses"
+};
+
+static double elapsed(struct timespec *start, clockid_t clk) {
+	struct timespec now;
+	double r;
+	clock_gettime(clk, &now);
+	r = (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec)/1e9;
+	*start = now;
+	return r;
+}
+
+void xcss_stats_init(xcss_stats_t s) {
+	int i;
+	memset(s, 0, sizeof(xcss_stats_s));
+	s->phase = XCSS_PHASE_IDLE;
+	s->perf_group = -1;
+	for(i=0; i<XCSS_PERF_COUNT; i++)
+		s->perf_fd[i] = -1;
+	clock_gettime(CLOCK_MONOTONIC, &s->wall_start);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &s->cpu_start);
+}
+
+#ifdef __linux__
+
+/* read format: nr, time enabled, time running, values of group members */
+#define PERF_READ_SIZE (3 + XCSS_PERF_COUNT)
+
+static const uint64_t perf_configs[XCSS_PERF_COUNT] = {
+	PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+};
+
+static int perf_open(uint64_t config, int group, int inherit) {
+	struct perf_event_attr a;
+	memset(&a, 0, sizeof(a));
+	a.size = sizeof(a);
+	a.type = PERF_TYPE_HARDWARE;
+	a.config = config;
+	a.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	/* user space only, so it works with perf_event_paranoid 2 */
+	a.exclude_kernel = 1;
+	a.exclude_hv = 1;
+	/* threads started later (parser, compression) are counted too */
+	a.inherit = inherit;
+	return syscall(SYS_perf_event_open, &a, 0, -1, group, PERF_FLAG_FD_CLOEXEC);
+}
+
+/**
+ * Read counters of group, scaled if they were multiplexed.
+ * Values of unavailable counters are zero.
+ */
+static int perf_read(xcss_stats_t s, uint64_t *values) {
+	uint64_t buf[PERF_READ_SIZE];
+	int i, j = 0;
+	if(read(s->perf_group, buf, sizeof(buf)) < (ssize_t)(3*sizeof(uint64_t)))
+		return 0;
+	for(i=0; i<XCSS_PERF_COUNT; i++) {
+		values[i] = 0;
+		if(s->perf_fd[i]<0 || j>=(int)buf[0])
+			continue;
+		values[i] = buf[3 + j++];
+		if(buf[2] && buf[2]<buf[1])
+			values[i] = (uint64_t)((double)values[i]*buf[1]/buf[2]);
+	}
+	return 1;
+}
+
+int xcss_stats_perf(xcss_stats_t s) {
+	int i, n = 0;
+	s->perf_inherit = 1;
+	for(i=0; i<XCSS_PERF_COUNT; i++) {
+		s->perf_fd[i] = perf_open(perf_configs[i], s->perf_group, s->perf_inherit);
+		if(s->perf_fd[i]<0 && s->perf_group<0 && s->perf_inherit) {
+			/* kernels which can't read inherited groups count the calling thread */
+			s->perf_inherit = 0;
+			s->perf_fd[i] = perf_open(perf_configs[i], s->perf_group, 0);
+		}
+		if(s->perf_fd[i]<0)
+			continue;
+		if(s->perf_group<0)
+			s->perf_group = s->perf_fd[i];
+		n++;
+	}
+	if(!n || !perf_read(s, s->perf_last)) {
+		xcss_stats_close(s);
+		return 0;
+	}
+	return n;
+}
+
+void xcss_stats_close(xcss_stats_t s) {
+	int i;
+	for(i=0; i<XCSS_PERF_COUNT; i++) {
+		if(s->perf_fd[i]>=0)
+			close(s->perf_fd[i]);
+		s->perf_fd[i] = -1;
+	}
+	s->perf_group = -1;
+}
+
+#else
+
+int xcss_stats_perf(xcss_stats_t s) {
+	return 0;
+}
+
+void xcss_stats_close(xcss_stats_t s) {
+}
+
+#endif
+
+xcss_phase_t xcss_stats_phase(xcss_stats_t s, xcss_phase_t p) {
+	xcss_phase_t r = s->phase;
+	s->wall[r] += elapsed(&s->wall_start, CLOCK_MONOTONIC);
+	/* of all threads, parser and compression ones included */
+	s->cpu[r] += elapsed(&s->cpu_start, CLOCK_PROCESS_CPUTIME_ID);
+#ifdef __linux__
+	if(s->perf_group>=0) {
+		uint64_t now[XCSS_PERF_COUNT];
+		int i;
+		if(perf_read(s, now)) {
+			for(i=0; i<XCSS_PERF_COUNT; i++) {
+				s->perf[r][i] += now[i] - s->perf_last[i];
+				s->perf_last[i] = now[i];
+			}
+		}
+	}
+#endif
+	s->phase = p;
+	return r;
+}
+
+static long peak_rss(void) {
+	struct rusage ru;
+	return getrusage(RUSAGE_SELF, &ru)==0 ? ru.ru_maxrss : 0;
+}
+
+static double per_kb(xcss_stats_t s, uint64_t n) {
+	return s->input_bytes ? n*1024.0/s->input_bytes : 0;
+}
+
+static void write_perf_row(xcss_stats_t s, FILE *f, const char *name, uint64_t *c) {
+	fprintf(f, "%-10s %14llu %14llu %6.2f", name, (unsigned long long)c[XCSS_PERF_CYCLES],
+			(unsigned long long)c[XCSS_PERF_INSTRUCTIONS],
+			c[XCSS_PERF_CYCLES] ? (double)c[XCSS_PERF_INSTRUCTIONS]/c[XCSS_PERF_CYCLES] : 0);
+	if(s->perf_fd[XCSS_PERF_CACHE_MISSES]>=0)
+		fprintf(f, " %14.2f", per_kb(s, c[XCSS_PERF_CACHE_MISSES]));
+	else
+		fprintf(f, " %14s", "-");
+	if(s->perf_fd[XCSS_PERF_BRANCH_MISSES]>=0)
+		fprintf(f, " %14.2f\n", per_kb(s, c[XCSS_PERF_BRANCH_MISSES]));
+	else
+		fprintf(f, " %14s\n", "-");
+}
+
+static void write_perf(xcss_stats_t s, FILE *f) {
+	uint64_t total[XCSS_PERF_COUNT];
+	int i, j;
+	memset(total, 0, sizeof(total));
+	if(!s->perf_inherit)
+		fprintf(f, "counters of the main thread only\n");
+	fprintf(f, "%-10s %14s %14s %6s %14s %14s\n", "phase", "cycles", "instructions", "ipc",
+			"cache miss/KB", "branch miss/KB");
+	for(i=XCSS_PHASE_READ; i<XCSS_PHASE_COUNT; i++) {
+		write_perf_row(s, f, phase_names[i], s->perf[i]);
+		for(j=0; j<XCSS_PERF_COUNT; j++)
+			total[j] += s->perf[i][j];
+	}
+	write_perf_row(s, f, "total", total);
+}
+
+void xcss_stats_write(xcss_stats_t s, heap_t h, FILE *f) {
+	int i;
+	double wall = 0, cpu = 0;
+	heap_stat_t hs = heap_stat(h);
+	xcss_stats_phase(s, s->phase);
+	fprintf(f, "%-10s %12s %12s\n", "phase", "wall, ms", "cpu, ms");
+	for(i=XCSS_PHASE_READ; i<XCSS_PHASE_COUNT; i++) {
+		fprintf(f, "%-10s %12.3f %12.3f\n", phase_names[i], s->wall[i]*1e3, s->cpu[i]*1e3);
+		wall += s->wall[i];
+		cpu += s->cpu[i];
+	}
+	fprintf(f, "%-10s %12.3f %12.3f\n", "total", wall*1e3, cpu*1e3);
+	fprintf(f, "input:     %zu bytes\n", s->input_bytes);
+	fprintf(f, "output:    %zu bytes\n", s->output_bytes);
+	fprintf(f, "heap:      %zu bytes used, %zu bytes reserved, %zu blocks (%zu large)\n",
+			hs.used, hs.reserved, hs.blocks, hs.large_blocks);
+	fprintf(f, "scratch:   %zu bytes peak, %zu bytes reserved\n", s->scratch_peak, s->scratch_reserved);
+	fprintf(f, "cache:     %zu bytes used, %zu bytes reserved, %zu files\n",
+			s->cache_used, s->cache_reserved, s->cache_files);
+	fprintf(f, "peak rss:  %ld KB\n", peak_rss());
+	fprintf(f, "nodes:     %zu\n", s->nodes);
+	fprintf(f, "classes:   %zu\n", s->classes);
+	fprintf(f, "rules:     %zu\n", s->rules);
+	fprintf(f, "variables: %zu\n", s->variables);
+	fprintf(f, "includes:  %zu\n", s->includes);
+	fprintf(f, "variable lookups: %zu (%zu scopes)\n", s->var_lookups, s->var_scopes);
+	fprintf(f, "class lookups:    %zu (%zu scopes)\n", s->class_lookups, s->class_scopes);
+	if(s->perf_group>=0)
+		write_perf(s, f);
+}
+
+void xcss_stats_write_json(xcss_stats_t s, heap_t h, FILE *f) {
+	int i, j;
+	heap_stat_t hs = heap_stat(h);
+	xcss_stats_phase(s, s->phase);
+	fprintf(f, "{\"phases\":{");
+	for(i=XCSS_PHASE_READ; i<XCSS_PHASE_COUNT; i++) {
+		fprintf(f, "%s\"%s\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f", i==XCSS_PHASE_READ ? "" : ",",
+				phase_names[i], s->wall[i]*1e3, s->cpu[i]*1e3);
+		if(s->perf_group>=0) {
+			uint64_t *c = s->perf[i];
+			for(j=0; j<XCSS_PERF_COUNT; j++)
+				if(s->perf_fd[j]>=0)
+					fprintf(f, ",\"%s\":%llu", perf_names[j], (unsigned long long)c[j]);
+			fprintf(f, ",\"ipc\":%.3f", c[XCSS_PERF_CYCLES] ?
+					(double)c[XCSS_PERF_INSTRUCTIONS]/c[XCSS_PERF_CYCLES] : 0);
+			if(s->perf_fd[XCSS_PERF_CACHE_MISSES]>=0)
+				fprintf(f, ",\"cache_misses_per_kb\":%.3f", per_kb(s, c[XCSS_PERF_CACHE_MISSES]));
+			if(s->perf_fd[XCSS_PERF_BRANCH_MISSES]>=0)
+				fprintf(f, ",\"branch_misses_per_kb\":%.3f", per_kb(s, c[XCSS_PERF_BRANCH_MISSES]));
+		}
+		fprintf(f, "}");
+	}
+	fprintf(f, "},\"input_bytes\":%zu,\"output_bytes\":%zu", s->input_bytes, s->output_bytes);
+	fprintf(f, ",\"heap\":{\"used\":%zu,\"reserved\":%zu,\"blocks\":%zu,\"large_blocks\":%zu}",
+			hs.used, hs.reserved, hs.blocks, hs.large_blocks);
+	fprintf(f, ",\"scratch\":{\"peak\":%zu,\"reserved\":%zu}", s->scratch_peak, s->scratch_reserved);
+	fprintf(f, ",\"cache\":{\"used\":%zu,\"reserved\":%zu,\"files\":%zu}",
+			s->cache_used, s->cache_reserved, s->cache_files);
+	if(s->perf_group>=0)
+		fprintf(f, ",\"perf_threads\":\"%s\"", s->perf_inherit ? "all" : "main");
+	fprintf(f, ",\"peak_rss_kb\":%ld", peak_rss());
+	fprintf(f, ",\"nodes\":%zu,\"classes\":%zu,\"rules\":%zu,\"variables\":%zu,\"includes\":%zu",
+			s->nodes, s->classes, s->rules, s->variables, s->includes);
+	fprintf(f, ",\"variable_lookups\":%zu,\"variable_scopes\":%zu,\"class_lookups\":%zu,\"class_scopes\":%zu}\n",
+			s->var_lookups, s->var_scopes, s->class_lookups, s->class_scopes);
+}
@@ -0,0 +1,81 @@
+#ifndef MAY_STATS_H
+#define MAY_STATS_H
+
+#include "maylib/heap.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef enum {
+	XCSS_PHASE_IDLE = 0,
+	XCSS_PHASE_READ = 1,
+	XCSS_PHASE_PARSE = 2,
+	XCSS_PHASE_EVALUATE = 3,
+	XCSS_PHASE_OUTPUT = 4,
+	XCSS_PHASE_COUNT = 5
+} xcss_phase_t;
+
+typedef enum {
+	XCSS_PERF_CYCLES = 0,
+	XCSS_PERF_INSTRUCTIONS = 1,
+	XCSS_PERF_CACHE_MISSES = 2,
+	XCSS_PERF_BRANCH_MISSES = 3,
+	XCSS_PERF_COUNT = 4
+} xcss_perf_t;
+
+typedef struct xcss_stats_ss {
+	double wall[XCSS_PHASE_COUNT];
+	double cpu[XCSS_PHASE_COUNT];     /* of process, all threads */
+	xcss_phase_t phase;
+	struct timespec wall_start;
+	struct timespec cpu_start;
+	int perf_fd[XCSS_PERF_COUNT];     /* -1 if counter is not available */
+	int perf_group;                   /* leader fd, -1 if counters are off */
+	int perf_inherit;                 /* counters include threads started later */
+	uint64_t perf_last[XCSS_PERF_COUNT];
+	uint64_t perf[XCSS_PHASE_COUNT][XCSS_PERF_COUNT];
+	size_t input_bytes;
+	size_t output_bytes;
+	size_t nodes;
+	size_t classes;
+	size_t rules;
+	size_t variables;
+	size_t includes;
+	size_t var_lookups;
+	size_t var_scopes;
+	size_t class_lookups;
+	size_t class_scopes;
+	size_t scratch_peak;              /* of heap includes are compiled in */
+	size_t scratch_reserved;
+	size_t cache_used;                /* of cached files, at the end of last compile */
+	size_t cache_reserved;
+	size_t cache_files;
+} xcss_stats_s;
+
+typedef xcss_stats_s *xcss_stats_t;
+
+/**
+ * Compilation statistics. Contexts without stats don't count anything.
+ */
+#define XCSS_STAT_ADD(x, field, n) { if((x)->stats) (x)->stats->field += (n); }
+
+void xcss_stats_init(xcss_stats_t);
+/**
+ * Count hardware events (perf_event_open) per phase, of calling thread
+ * and threads it starts later (or of calling thread only, on kernels
+ * which can't do it, then perf_inherit is zero).
+ * Returns number of available counters, zero if hardware counters can't
+ * be used here (then only time is measured). Counters are released by
+ * xcss_stats_close.
+ */
+int xcss_stats_perf(xcss_stats_t);
+void xcss_stats_close(xcss_stats_t);
+/**
+ * Account time since last switch to current phase and switch to given one.
+ * Returns previous phase.
+ */
+xcss_phase_t xcss_stats_phase(xcss_stats_t, xcss_phase_t);
+void xcss_stats_write(xcss_stats_t, heap_t, FILE *);
+void xcss_stats_write_json(xcss_stats_t, heap_t, FILE *);
+
+#endif /* MAY_STATS_H */
@@ -2,7 +2,7 @@
 #include "syntree.h"
 
 syntree_t syntree_create(heap_t h, str_t s) {
-	syntree_t r = heap_alloc(h, sizeof(struct syntree_node_s));
+	syntree_t r = heap_alloc(h, sizeof(struct syntree_s));
 	if(r) {
 		r->heap = h;
 		r->first = r->last = 0;
@@ -14,7 +14,7 @@ syntree_t syntree_create(heap_t h, str_t s) {
 }
 
 syntree_t syntree_transaction(syntree_t st) {
-	syntree_t r = heap_alloc(st->heap, sizeof(struct syntree_node_s));
+	syntree_t r = heap_alloc(st->heap, sizeof(struct syntree_s));
 	if(r) {
 		r->heap = st->heap;
 		r->position = st->position;
@@ -0,0 +1,117 @@
+#include "trace.h"
+#include "maylib/mem.h"
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+int xcss_trace_enabled = 0;
+
+static size_t trace_size = 0;
+static uint64_t trace_origin = 0;
+static int trace_tids = 0;
+static xcss_trace_t trace_list = 0;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread xcss_trace_t trace_local = 0;
+
+uint64_t xcss_trace_now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec*1000000000u + t.tv_nsec;
+}
+
+void xcss_trace_start(size_t events_per_thread) {
+	trace_size = events_per_thread ? events_per_thread : XCSS_TRACE_DEFAULT_EVENTS;
+	trace_origin = xcss_trace_now();
+	xcss_trace_enabled = 1;
+}
+
+static xcss_trace_t trace_thread(void) {
+	xcss_trace_t t = mem_alloc(sizeof(xcss_trace_s));
+	if(err())
+		return 0;
+	t->events = mem_alloc(trace_size*sizeof(xcss_trace_event_s));
+	if(err()) {
+		mem_free(t);
+		return 0;
+	}
+	t->count = 0;
+	pthread_mutex_lock(&trace_lock);
+	t->tid = ++trace_tids;
+	t->next = trace_list;
+	trace_list = t;
+	pthread_mutex_unlock(&trace_lock);
+	return t;
+}
+
+void xcss_trace_end(uint64_t start, const char *cat, const char *name, size_t len) {
+	xcss_trace_event_s *e;
+	if(!start)
+		return;
+	if(!trace_local) {
+		trace_local = trace_thread();
+		if(!trace_local) {
+			err_clear();
+			return;
+		}
+	}
+	e = trace_local->events + (trace_local->count++ % trace_size);
+	e->ts = start;
+	e->dur = xcss_trace_now() - start;
+	e->cat = cat;
+	if(len>=XCSS_TRACE_NAME_SIZE) {
+		len = XCSS_TRACE_NAME_SIZE - 1;
+		/* don't split UTF-8 character */
+		while(len && ((unsigned char)name[len] & 0xC0)==0x80)
+			len--;
+	}
+	memcpy(e->name, name, len);
+	e->name[len] = 0;
+}
+
+static void write_name(FILE *f, const char *s) {
+	for(; *s; s++) {
+		unsigned char c = *s;
+		if(c=='"' || c=='\\')
+			fprintf(f, "\\%c", c);
+		else if(c<0x20)
+			fprintf(f, "\\u%04x", c);
+		else
+			fputc(c, f);
+	}
+}
+
+void xcss_trace_write(FILE *f) {
+	xcss_trace_t t;
+	int first = 1;
+	fprintf(f, "{\"traceEvents\":[\n");
+	pthread_mutex_lock(&trace_lock);
+	for(t=trace_list; t; t=t->next) {
+		size_t i = t->count>trace_size ? t->count - trace_size : 0;
+		for(; i<t->count; i++) {
+			xcss_trace_event_s *e = t->events + (i % trace_size);
+			fprintf(f, "%s{\"name\":\"", first ? "" : ",\n");
+			write_name(f, e->name);
+			fprintf(f, "\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+					e->cat, (e->ts - trace_origin)/1e3, e->dur/1e3, t->tid);
+			first = 0;
+		}
+	}
+	pthread_mutex_unlock(&trace_lock);
+	fprintf(f, "\n]}\n");
+	xcss_trace_stop();
+}
+
+void xcss_trace_stop(void) {
+	xcss_trace_t t, next;
+	xcss_trace_enabled = 0;
+	pthread_mutex_lock(&trace_lock);
+	for(t=trace_list; t; t=next) {
+		next = t->next;
+		mem_free(t->events);
+		mem_free(t);
+	}
+	trace_list = 0;
+	trace_tids = 0;
+	pthread_mutex_unlock(&trace_lock);
+	trace_local = 0;
+}
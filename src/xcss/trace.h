@@ -0,0 +1,50 @@
+#ifndef MAY_TRACE_H
+#define MAY_TRACE_H
+
+#include "maylib/err.h"
+#include <stdio.h>
+#include <stdint.h>
+
+#define XCSS_TRACE_NAME_SIZE 56
+#define XCSS_TRACE_DEFAULT_EVENTS (1024*64)
+
+typedef struct {
+	uint64_t ts;
+	uint64_t dur;
+	const char *cat;
+	char name[XCSS_TRACE_NAME_SIZE];
+} xcss_trace_event_s;
+
+typedef struct xcss_trace_ss {
+	xcss_trace_event_s *events;
+	size_t count;
+	int tid;
+	struct xcss_trace_ss *next;
+} xcss_trace_s;
+
+typedef xcss_trace_s *xcss_trace_t;
+
+extern int xcss_trace_enabled;
+
+/**
+ * Chrome trace-event spans. Each thread writes to its own ring buffer,
+ * so only the newest events are kept if a buffer overflows.
+ * Spans are recorded when they end, so begin costs one clock read and
+ * nothing at all while tracing is off.
+ */
+void xcss_trace_start(size_t events_per_thread);
+uint64_t xcss_trace_now(void);
+#define xcss_trace_begin() (xcss_trace_enabled ? xcss_trace_now() : 0)
+void xcss_trace_end(uint64_t start, const char *cat, const char *name, size_t len);
+/**
+ * Write events of all threads, then stop tracing (xcss_trace_stop).
+ * Threads must not trace at the same time.
+ */
+void xcss_trace_write(FILE *);
+/**
+ * Stop tracing and free buffers of all threads. Threads which traced
+ * must have exited, except the calling one.
+ */
+void xcss_trace_stop(void);
+
+#endif /* MAY_TRACE_H */
@@ -0,0 +1,30 @@
+#include "used.h"
+
+/* letters, digits, '-', '_' and any byte of multibyte UTF-8 characters */
+#define name_char(c) (((c)>='a' && (c)<='z') || ((c)>='A' && (c)<='Z') \
+	|| ((c)>='0' && (c)<='9') || (c)=='-' || (c)=='_' || (c)>=0x80)
+
+void xcss_scan_used(heap_t h, map_t m, str_t text) {
+	const unsigned char *i = (const unsigned char *)str_begin(text);
+	const unsigned char *e = (const unsigned char *)str_end(text);
+	may_str_s word;
+	while(i<e) {
+		const unsigned char *b;
+		for(; i<e && !name_char(*i); i++);
+		for(b=i; i<e && name_char(*i); i++);
+		if(i==b)
+			break;
+		/* look up on stack, most words of templates repeat */
+		word.data = (char *)b;
+		word.length = i - b;
+		word.hash = 0;
+		if(!map_get(m, &word)) {
+			str_t key = str_interval(h, (str_it_t)b, (str_it_t)i);
+			if(err())
+				return;
+			map_set(m, key, key);
+			if(err())
+				return;
+		}
+	}
+}
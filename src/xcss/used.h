@@ -0,0 +1,17 @@
+#ifndef MAY_USED_H
+#define MAY_USED_H
+
+#include "maylib/err.h"
+#include "maylib/heap.h"
+#include "maylib/str.h"
+#include "maylib/map.h"
+
+/**
+ * Add every word of text that may be a class name to map (as key and
+ * value). Lists of names and HTML or JS templates are read the same way,
+ * so every class name is matched in one pass, without knowing classes.
+ * Keys are intervals of text, so text must live as long as map.
+ */
+void xcss_scan_used(heap_t, map_t, str_t text);
+
+#endif /* MAY_USED_H */
@@ -0,0 +1,156 @@
+#include "watch.h"
+#include "maylib/mem.h"
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string.h>
+
+ERR_DEFINE(e_xcss_watch, "Can't watch files.", 0);
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE)
+#define WATCH_BUFFER_SIZE (1024*16)
+#define WATCH_DELAY 20
+
+typedef struct {
+	heap_t heap;
+	int fd;
+	map_t dirs;
+	str_t *wds;
+	int wds_count;
+	FILE *serr;
+} watch_s;
+
+static void watch_file(watch_s *w, str_t fname) {
+	str_it_t i;
+	str_t dir;
+	int wd;
+	for(i=str_end(fname); i>str_begin(fname) && i[-1]!='/'; i--);
+	dir = str_interval(w->heap, str_begin(fname), i);
+	if(err())
+		return;
+	if(map_get(w->dirs, dir))
+		return;
+	dir = str_clone(w->heap, dir);
+	if(err())
+		return;
+	wd = inotify_add_watch(w->fd, str_length(dir) ? str_begin(dir) : ".", WATCH_EVENTS);
+	if(wd<0) {
+		fprintf(w->serr, "Can't watch directory \"%s\".\n", str_length(dir) ? str_begin(dir) : ".");
+		return;
+	}
+	map_set(w->dirs, dir, dir);
+	if(wd>=w->wds_count) {
+		int c = w->wds_count;
+		w->wds_count = wd*2 + 1;
+		w->wds = mem_realloc(w->wds, w->wds_count*sizeof(str_t));
+		if(err())
+			return;
+		memset(w->wds + c, 0, (w->wds_count - c)*sizeof(str_t));
+	}
+	w->wds[wd] = dir;
+}
+
+static void compile_entry(watch_s *w, xcss_entry_t e, xcss_compile_f f, void *data) {
+	map_node_t i;
+	heap_delete(e->heap);
+	e->heap = heap_create(0);
+	if(err())
+		return;
+	e->deps = map_create(e->heap);
+	if(err())
+		return;
+	map_set(e->deps, e->input, e->input);
+	/* compile function reports its own errors */
+	f(data, e);
+	err_clear();
+	for(i=map_begin(e->deps); i; i=map_next(i)) {
+		watch_file(w, i->key);
+		if(err())
+			return;
+	}
+}
+
+static void read_events(watch_s *w, heap_t h, map_t changed) {
+	char buf[WATCH_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	char *i;
+	len = read(w->fd, buf, sizeof(buf));
+	if(len<=0) {
+		err_set(e_xcss_watch);
+		return;
+	}
+	for(i=buf; i<buf+len; i+=sizeof(struct inotify_event) + ((struct inotify_event *)i)->len) {
+		struct inotify_event *ev = (struct inotify_event *)i;
+		str_t nm;
+		if(!ev->len || ev->wd>=w->wds_count || !w->wds[ev->wd])
+			continue;
+		nm = str_from_cs(h, ev->name);
+		if(err())
+			return;
+		nm = str_cat(h, w->wds[ev->wd], nm);
+		if(err())
+			return;
+		map_set(changed, nm, nm);
+	}
+}
+
+void xcss_watch(heap_t h, xcss_cache_t cache, xcss_entry_t entries, size_t count, xcss_compile_f f, void *data, FILE *serr) {
+	watch_s w;
+	size_t c;
+	w.heap = h;
+	w.serr = serr;
+	w.wds = 0;
+	w.wds_count = 0;
+	w.dirs = map_create(h);
+	if(err())
+		return;
+	w.fd = inotify_init1(IN_CLOEXEC);
+	if(w.fd<0) {
+		err_set(e_xcss_watch);
+		return;
+	}
+	for(c=0; c<count; c++) {
+		compile_entry(&w, entries + c, f, data);
+		if(err())
+			goto clean;
+	}
+	fflush(0);
+	while(1) {
+		struct pollfd pfd;
+		map_node_t i;
+		map_t changed;
+		heap_t tmph = heap_create(0);
+		if(err())
+			goto clean;
+		changed = map_create(tmph);
+		/* editors write a file in several steps, collect them all */
+		pfd.fd = w.fd;
+		pfd.events = POLLIN;
+		do {
+			read_events(&w, tmph, changed);
+			if(err()) {
+				heap_delete(tmph);
+				goto clean;
+			}
+		} while(poll(&pfd, 1, WATCH_DELAY)>0);
+		for(i=map_begin(changed); i; i=map_next(i))
+			xcss_cache_invalidate(cache, i->key);
+		for(c=0; c<count; c++) {
+			for(i=map_begin(changed); i; i=map_next(i)) {
+				if(map_get(entries[c].deps, i->key)) {
+					compile_entry(&w, entries + c, f, data);
+					break;
+				}
+			}
+			if(err()) {
+				heap_delete(tmph);
+				goto clean;
+			}
+		}
+		heap_delete(tmph);
+		fflush(0);
+	}
+clean:
+	close(w.fd);
+	mem_free(w.wds);
+}
@@ -0,0 +1,35 @@
+#ifndef MAY_WATCH_H
+#define MAY_WATCH_H
+
+#include "maylib/err.h"
+#include "maylib/heap.h"
+#include "maylib/str.h"
+#include "maylib/map.h"
+#include "cache.h"
+#include <stdio.h>
+
+ERR_DECLARE(e_xcss_watch);
+
+typedef struct xcss_entry_ss {
+	str_t input;
+	const char *output;
+	heap_t heap;
+	map_t deps;
+} xcss_entry_s;
+
+typedef xcss_entry_s *xcss_entry_t;
+
+/**
+ * Compile entry. Every file read during compilation must be added
+ * to entry->deps. Entry heap lives until the entry is compiled again.
+ * Errors are reported by compile function.
+ */
+typedef void (*xcss_compile_f)(void *, xcss_entry_t);
+
+/**
+ * Compile all entries, then wait for changes of their dependencies
+ * and recompile only affected entries. Returns on inotify failure only.
+ */
+void xcss_watch(heap_t, xcss_cache_t, xcss_entry_t, size_t count, xcss_compile_f, void *, FILE *serr);
+
+#endif /* MAY_WATCH_H */
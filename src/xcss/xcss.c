@@ -0,0 +1,1095 @@
+#include "xcss.h"
+#include "parser.h"
+#include "syntree.h"
+#include "deps.h"
+#include "io.h"
+#include "trace.h"
+#include "calc.h"
+#include "lines.h"
+#include "binary.h"
+#include <assert.h>
+#include <string.h>
+
+ERR_DEFINE(e_xcss_class, "Class not found.", 0);
+ERR_DEFINE(e_xcss_variable, "Variable not found.", 0);
+ERR_DEFINE(e_xcss_overflow, "Output buffer is too small.", 0);
+
+typedef struct xcss_rule_ss {
+	str_t name;
+	str_t value;
+	syntree_node_t node;            /* for source map */
+	xcss_smap_source_t source;
+	struct xcss_rule_ss *next;
+} xcss_rule_s;
+
+typedef xcss_rule_s *xcss_rule_t;
+
+typedef struct xcss_class_ref_ss {
+	struct xcss_class_ss *cl;
+	struct xcss_class_ref_ss *next;
+} xcss_class_ref_s;
+
+typedef xcss_class_ref_s *xcss_class_ref_t;
+
+typedef struct xcss_class_ss {
+	str_t name;
+	str_t prefix;
+	heap_t heap;
+	str_it_t position;              /* for source map */
+	xcss_smap_source_t source;
+	xcss_rule_t first_rule;
+	xcss_rule_t last_rule;
+	/* unused class, rules are resolved only if it is inherited */
+	int lazy;
+	syntree_node_t body;
+	struct xcss_ns_ss *ns;
+	xcss_class_ref_t parents;
+	str_t file;
+	str_t content;
+	struct xcss_class_ss *next_lazy;
+} xcss_class_s;
+
+typedef xcss_class_s *xcss_class_t;
+
+typedef struct xcss_ns_ss {
+	map_t classes;
+	map_t vars;
+	struct xcss_ns_ss *parent;
+} xcss_ns_s;
+
+typedef xcss_ns_s *xcss_ns_t;
+
+static str_t read_resolve(void *data, heap_t h, str_t fname) {
+	(void)data;
+	return xcss_read_file(h, fname);
+}
+
+xcss_t xcss_create(heap_t h) {
+	xcss_t r = heap_alloc(h, sizeof(xcss_s));
+	if(err())
+		return 0;
+	r->heap = h;
+	r->resolve = read_resolve;
+	r->resolve_data = 0;
+	r->write = 0;
+	r->write_data = 0;
+	r->cache = 0;
+	r->files = 0;
+	r->includes = 0;
+	r->out = 0;
+	r->out_size = 0;
+	r->out_used = 0;
+	r->length = 0;
+	r->out_external = 0;
+	r->file = 0;
+	r->source = 0;
+	r->first_diag = r->last_diag = 0;
+	r->lines = 0;
+	r->stats = 0;
+	r->smap = 0;
+	r->smap_source = 0;
+	r->shard_write = 0;
+	r->shard_data = 0;
+	r->shard = 0;
+	r->used = 0;
+	r->lazy = 0;
+	r->lazy_refs = 0;
+	r->threads = 1;
+	r->vars = 0;
+	r->class_hook = 0;
+	r->class_data = 0;
+	r->capture = 0;
+	r->capture_used = r->capture_size = 0;
+	r->capturing = 0;
+	r->scratch = 0;
+	r->temp = h;
+	r->scoped = 0;
+	return r;
+}
+
+void xcss_set_resolver(xcss_t x, xcss_resolve_f f, void *data) {
+	x->resolve = f;
+	x->resolve_data = data;
+}
+
+void xcss_set_sink(xcss_t x, xcss_write_f f, void *data) {
+	x->shard_write = 0;
+	x->write = f;
+	x->write_data = data;
+	if(!x->out || x->out_external) {
+		x->out = heap_alloc(x->heap, XCSS_OUT_BUFFER_SIZE);
+		x->out_size = err() ? 0 : XCSS_OUT_BUFFER_SIZE;
+		x->out_external = 0;
+	}
+}
+
+static void shard_sink(void *data, const char *s, size_t sz) {
+	xcss_t x = data;
+	x->shard_write(x->shard_data, x->shard, s, sz);
+}
+
+void xcss_set_shard_sink(xcss_t x, xcss_shard_write_f f, void *data) {
+	xcss_set_sink(x, shard_sink, x);
+	x->shard_write = f;
+	x->shard_data = data;
+}
+
+void xcss_set_buffer(xcss_t x, char *buf, size_t sz) {
+	x->write = 0;
+	x->shard_write = 0;
+	x->out = buf;
+	x->out_size = sz;
+	x->out_external = 1;
+}
+
+void xcss_set_cache(xcss_t x, xcss_cache_t c) {
+	x->cache = c;
+}
+
+void xcss_set_includes(xcss_t x, map_t m) {
+	x->includes = m;
+}
+
+void xcss_set_used(xcss_t x, map_t m) {
+	x->used = m;
+}
+
+void xcss_set_stats(xcss_t x, xcss_stats_t s) {
+	x->stats = s;
+}
+
+void xcss_set_source_map(xcss_t x, xcss_smap_t m) {
+	x->smap = m;
+}
+
+void xcss_set_class_hook(xcss_t x, xcss_class_f f, void *data) {
+	x->class_hook = f;
+	x->class_data = data;
+}
+
+void xcss_set_vars(xcss_t x, map_t m) {
+	x->vars = m;
+}
+
+void xcss_set_threads(xcss_t x, int n) {
+	x->threads = n;
+}
+
+size_t xcss_length(xcss_t x) {
+	return x->length;
+}
+
+xcss_diag_t xcss_diagnostics(xcss_t x) {
+	return x->first_diag;
+}
+
+void xcss_file_sink(void *f, const char *data, size_t sz) {
+	fwrite(data, 1, sz, f);
+}
+
+static void out_flush(xcss_t x) {
+	if(!x->out_external && x->out_used) {
+		if(x->write) {
+			uint64_t ts = xcss_trace_begin();
+			xcss_phase_t p = x->stats ? xcss_stats_phase(x->stats, XCSS_PHASE_OUTPUT) : 0;
+			x->write(x->write_data, x->out, x->out_used);
+			if(x->stats)
+				xcss_stats_phase(x->stats, p);
+			xcss_trace_end(ts, "output", "flush", 5);
+		}
+		x->out_used = 0;
+	}
+}
+
+static void capture(xcss_t x, const char *data, size_t sz) {
+	if(x->capture_used + sz > x->capture_size) {
+		size_t nsz = x->capture_size ? x->capture_size*2 : 1024;
+		char *n;
+		while(nsz<x->capture_used + sz)
+			nsz *= 2;
+		n = heap_alloc(x->heap, nsz);
+		if(err()) {
+			x->capturing = 0;
+			return;
+		}
+		if(x->capture_used)
+			memcpy(n, x->capture, x->capture_used);
+		x->capture = n;
+		x->capture_size = nsz;
+	}
+	memcpy(x->capture + x->capture_used, data, sz);
+	x->capture_used += sz;
+}
+
+static void out_write(xcss_t x, const char *data, size_t sz) {
+	x->length += sz;
+	if(x->capturing)
+		capture(x, data, sz);
+	if(x->smap)
+		xcss_smap_output(x->smap, data, sz);
+	if(x->out_external) {
+		if(x->out_used<x->out_size) {
+			size_t c = x->out_size - x->out_used;
+			if(c>sz)
+				c = sz;
+			memcpy(x->out + x->out_used, data, c);
+			x->out_used += c;
+		}
+	} else if(x->write) {
+		if(x->out_used + sz > x->out_size) {
+			out_flush(x);
+			if(sz>x->out_size) {
+				xcss_phase_t p = x->stats ? xcss_stats_phase(x->stats, XCSS_PHASE_OUTPUT) : 0;
+				x->write(x->write_data, data, sz);
+				if(x->stats)
+					xcss_stats_phase(x->stats, p);
+				return;
+			}
+		}
+		memcpy(x->out + x->out_used, data, sz);
+		x->out_used += sz;
+	}
+}
+
+#define out_cs(x, s) out_write((x), (s), sizeof(s) - 1)
+#define out_str(x, s) out_write((x), str_begin(s), str_length(s))
+
+static void diag_add(xcss_t x, const err_t *e, str_t subject, str_it_t position) {
+	xcss_diag_t d;
+	err_clear();
+	d = heap_alloc(x->heap, sizeof(xcss_diag_s));
+	if(!err()) {
+		d->error = e;
+		d->file = x->file;
+		d->subject = subject;
+		d->offset = (position && x->source) ? (size_t)(position - str_begin(x->source)) : XCSS_NO_OFFSET;
+		d->source = d->offset==XCSS_NO_OFFSET ? 0 : x->source;
+		d->line = d->column = 0;
+		d->next = 0;
+		if(x->last_diag)
+			x->last_diag = x->last_diag->next = d;
+		else
+			x->first_diag = x->last_diag = d;
+	}
+	err_replace(e);
+}
+
+static xcss_class_t class_create(xcss_t x, str_t nm, str_t prefix, str_it_t position) {
+	xcss_class_t cl = heap_alloc(x->heap, sizeof(xcss_class_s));
+	if(err())
+		return 0;
+	cl->name = nm;
+	cl->prefix = prefix;
+	cl->heap = x->heap;
+	cl->position = position;
+	cl->source = x->smap_source;
+	cl->lazy = 0;
+	cl->parents = 0;
+	cl->first_rule = cl->last_rule = 0;
+	return cl;
+}
+
+static void class_append_rule(xcss_class_t cl, str_t nm, str_t val,
+							  syntree_node_t node, xcss_smap_source_t source) {
+	xcss_rule_t i, prev;
+	xcss_rule_t r = heap_alloc(cl->heap, sizeof(xcss_rule_s));
+	if(err())
+		return;
+	r->name = nm;
+	r->value = val;
+	r->node = node;
+	r->source = source;
+	r->next = 0;
+	/* names are compared with every rule, hash lets str_equal skip most */
+	str_hash(nm);
+	for(i=cl->first_rule, prev=0; i; prev=i, i=i->next) {
+		if(str_equal(i->name, nm)) {
+			if(!prev)
+				cl->first_rule = i->next;
+			else if(!i->next) {
+				cl->last_rule = prev;
+				prev->next = 0;
+			} else
+				prev->next = i->next;
+			break;
+		}
+	}
+	if(cl->last_rule) {
+		cl->last_rule->next = r;
+		cl->last_rule = r;
+	} else
+		cl->last_rule = cl->first_rule = r;
+	return;
+}
+
+static void class_write(xcss_t x, xcss_class_t cl) {
+	xcss_rule_t i;
+	xcss_smap_t sm = x->smap;
+	if(sm)
+		xcss_smap_add(sm, cl->source, cl->position);
+	if(x->class_hook) {
+		x->capturing = 1;
+		x->capture_used = 0;
+	}
+	out_cs(x, ".");
+	if(cl->prefix)
+		out_str(x, cl->prefix);
+	out_str(x, cl->name);
+	out_cs(x, " {\n");
+	for(i=cl->first_rule; i; i=i->next) {
+		out_cs(x, "\t");
+		if(sm)
+			xcss_smap_add(sm, i->source, syntree_child(i->node)->position);
+		out_str(x, i->name);
+		out_cs(x, ": ");
+		if(sm)
+			xcss_smap_add(sm, i->source, syntree_next(syntree_child(i->node))->position);
+		out_str(x, i->value);
+		out_cs(x, ";\n");
+	}
+	out_cs(x, "}\n\n");
+	if(x->capturing) {
+		may_str_s sel, block;
+		x->capturing = 0;
+		block.data = x->capture;
+		block.length = x->capture_used;
+		block.hash = 0;
+		sel.data = x->capture;
+		sel.length = 1 + (cl->prefix ? str_length(cl->prefix) : 0) + str_length(cl->name);
+		sel.hash = 0;
+		x->class_hook(x->class_data, &sel, &block);
+	}
+}
+
+static int class_used(xcss_t x, xcss_class_t cl) {
+	str_t nm = cl->name;
+	if(cl->prefix) {
+		nm = str_cat(x->temp, cl->prefix, nm);
+		if(err())
+			return 1;
+	}
+	return map_get(x->used, nm)!=0;
+}
+
+static void class_add_parent(xcss_t x, xcss_class_t cl, xcss_class_t p) {
+	xcss_class_ref_t *i;
+	xcss_class_ref_t r = heap_alloc(x->heap, sizeof(xcss_class_ref_s));
+	if(err())
+		return;
+	r->cl = p;
+	r->next = 0;
+	for(i=&cl->parents; *i; i=&(*i)->next);
+	*i = r;
+}
+
+static void class_append_class(xcss_class_t cl, xcss_class_t p) {
+	if(p) {
+		xcss_rule_t i;
+		for(i=p->first_rule; i; i=i->next) {
+			class_append_rule(cl, i->name, i->value, i->node, i->source);
+			if(err())
+				return;
+		}
+	}
+}
+
+static xcss_ns_t ns_create(heap_t h, xcss_ns_t p) {
+	xcss_ns_t r = heap_alloc(h, sizeof(xcss_ns_s));
+	if(err())
+		return 0;
+	r->parent = p;
+	r->classes = map_create(h);
+	if(err())
+		return 0;
+	r->vars = map_create(h);
+	if(err())
+		return 0;
+	return r;
+}
+
+static void ns_add_var(xcss_ns_t ns, str_t nm, str_t vl) {
+	map_set(ns->vars, nm, vl);
+}
+
+static str_t ns_get_var(xcss_t x, xcss_ns_t ns, str_t nm) {
+	XCSS_STAT_ADD(x, var_lookups, 1);
+	for(; ns; ns=ns->parent) {
+		str_t r;
+		XCSS_STAT_ADD(x, var_scopes, 1);
+		r = map_get(ns->vars, nm);
+		if(r)
+			return r;
+	}
+	return 0;
+}
+
+static void ns_add_class(xcss_ns_t ns, xcss_class_t vl) {
+	map_set(ns->classes, vl->name, vl);
+}
+
+
+static xcss_class_t ns_get_class(xcss_t x, xcss_ns_t ns, str_t nm) {
+	XCSS_STAT_ADD(x, class_lookups, 1);
+	for(; ns; ns=ns->parent) {
+		xcss_class_t r;
+		XCSS_STAT_ADD(x, class_scopes, 1);
+		r = map_get(ns->classes, nm);
+		if(r)
+			return r;
+	}
+	return 0;
+}
+
+static void heap_free(void *h) {
+	heap_delete(h);
+}
+
+/**
+ * Decide if includes are compiled in scratch heap.
+ */
+static void scope_begin(xcss_t x) {
+	x->temp = x->heap;
+	/* lazy classes and source map refer to sources until the end */
+	x->scoped = !x->used && !x->smap;
+	if(!x->scoped)
+		return;
+	if(!x->scratch) {
+		heap_t h = heap_create(0);
+		if(err())
+			return;
+		heap_on_delete(x->heap, heap_free, h);
+		if(err()) {
+			heap_delete(h);
+			return;
+		}
+		x->scratch = h;
+	}
+}
+
+/**
+ * Count high-water mark of scratch heap, it is taken before release.
+ */
+static void scratch_stat(xcss_t x) {
+	heap_stat_t hs;
+	if(!x->stats || !x->scratch)
+		return;
+	hs = heap_stat(x->scratch);
+	if(hs.used>x->stats->scratch_peak)
+		x->stats->scratch_peak = hs.used;
+	if(hs.reserved>x->stats->scratch_reserved)
+		x->stats->scratch_reserved = hs.reserved;
+}
+
+/**
+ * Copy string made in x->temp to x->heap, so it outlives the include.
+ */
+static str_t keep(xcss_t x, str_t s) {
+	return (x->temp==x->heap || !s) ? s : str_clone(x->heap, s);
+}
+
+static size_t count_nodes(syntree_node_t i) {
+	size_t r = 0;
+	for(; i; i=i->next)
+		r += i->is_start;
+	return r;
+}
+
+static void trace_file(xcss_t x, uint64_t ts, const char *cat) {
+	if(x->file)
+		xcss_trace_end(ts, cat, str_begin(x->file), str_length(x->file));
+	else
+		xcss_trace_end(ts, cat, "<input>", 7);
+}
+
+/**
+ * Parse x->source, errors are added to diagnostics.
+ */
+static syntree_t parse(xcss_t x) {
+	syntree_t st;
+	xcss_phase_t p = 0;
+	uint64_t ts = xcss_trace_begin();
+	str_it_t error = 0;
+	if(x->stats)
+		p = xcss_stats_phase(x->stats, XCSS_PHASE_PARSE);
+	st = xcss_to_syntree_parallel(x->temp, x->source, x->threads, &error);
+	if(x->stats) {
+		x->stats->input_bytes += str_length(x->source);
+		if(!err())
+			x->stats->nodes += count_nodes(syntree_begin(st));
+		xcss_stats_phase(x->stats, p);
+	}
+	if(ts)
+		trace_file(x, ts, "parse");
+	if(err())
+		diag_add(x, err_get(), 0, err_get()==e_xcss_syntax ? error : 0);
+	return st;
+}
+
+static void set_source(xcss_t x, str_t source) {
+	x->source = source;
+	if(x->smap)
+		x->smap_source = xcss_smap_source(x->smap, x->file, source);
+}
+
+static str_t resolve(xcss_t x, str_t fname) {
+	str_t r = x->resolve(x->resolve_data, x->temp, fname);
+	return err() ? 0 : xcss_decode(x->temp, r);
+}
+
+/**
+ * Read and parse file, errors are added to diagnostics.
+ */
+static syntree_t load_syntree(xcss_t x, str_t fname) {
+	uint64_t ts;
+	if(x->includes) {
+		str_t key = str_clone(x->heap, fname);
+		if(err())
+			return 0;
+		map_set(x->includes, key, key);
+	}
+	if(x->cache) {
+		xcss_file_ref_t r = heap_alloc(x->heap, sizeof(xcss_file_ref_s));
+		if(err())
+			return 0;
+		ts = xcss_trace_begin();
+		if(x->stats) {
+			xcss_phase_t p = xcss_stats_phase(x->stats, XCSS_PHASE_READ);
+			r->file = xcss_cache_get(x->cache, fname);
+			xcss_stats_phase(x->stats, p);
+		} else
+			r->file = xcss_cache_get(x->cache, fname);
+		if(err()) {
+			diag_add(x, err_get(), 0, 0);
+			return 0;
+		}
+		trace_file(x, ts, "read");
+		r->next = x->files;
+		x->files = r;
+		set_source(x, r->file->content);
+		if(err())
+			return 0;
+		if(!r->file->syntree)
+			diag_add(x, e_xcss_syntax, 0, r->file->error);
+		return r->file->syntree;
+	} else {
+		str_t cnt = 0;
+		syntree_t st = 0;
+		xcss_phase_t p = 0;
+		ts = xcss_trace_begin();
+		if(x->stats)
+			p = xcss_stats_phase(x->stats, XCSS_PHASE_READ);
+		/* files of other resolvers may not be on disk */
+		if(x->resolve==read_resolve)
+			st = xcss_binary_load(x->temp, fname, 0, &cnt);
+		if(!st && !err())
+			cnt = resolve(x, fname);
+		if(x->stats)
+			xcss_stats_phase(x->stats, p);
+		if(err()) {
+			diag_add(x, err_get(), 0, 0);
+			return 0;
+		}
+		trace_file(x, ts, "read");
+		set_source(x, cnt);
+		if(err())
+			return 0;
+		if(st) {
+			if(x->stats) {
+				x->stats->input_bytes += str_length(cnt);
+				x->stats->nodes += count_nodes(syntree_begin(st));
+			}
+			return st;
+		}
+		return parse(x);
+	}
+}
+
+/**
+ * Concatenate text and variable values of parts, folding calc().
+ */
+static str_t get_value_parts(xcss_t x, xcss_ns_t ns, syntree_node_t nd) {
+	str_t r;
+	heap_t h = x->temp;
+	r = str_from_cs(h, "");
+	if(err())
+		return 0;
+	for(; nd; nd=syntree_next(nd)) {
+		str_t s;
+		switch(syntree_name(nd)) {
+			case XCSS_NODE_TEXT:
+				s = syntree_value(nd);
+				break;
+			case XCSS_NODE_CALC:
+				s = get_value_parts(x, ns, syntree_child(nd));
+				if(err() || !s)
+					return 0;
+				s = xcss_calc(h, s);
+				break;
+			default: /* XCSS_NODE_NAME */
+				s = syntree_value(nd);
+				if(err())
+					return 0;
+				s = ns_get_var(x, ns, s);
+				if(err())
+					return 0;
+				if(!s) {
+					diag_add(x, e_xcss_variable, syntree_value(nd), nd->position);
+					return 0;
+				}
+		}
+		if(err())
+			return 0;
+		r = str_cat(h, r, s);
+		if(err())
+			return 0;
+	}
+	return r;
+}
+
+static str_t get_rule_value(xcss_t x, xcss_ns_t ns, syntree_node_t nd) {
+	str_t r;
+	assert(syntree_name(nd)==XCSS_NODE_VALUE);
+	r = get_value_parts(x, ns, syntree_child(nd));
+	return err() ? 0 : keep(x, r);
+}
+
+/**
+ * Parse class body in x->source and append its rules. Syntax errors of
+ * bodies are found here, the first pass only matches braces.
+ */
+static void class_rules(xcss_t x, xcss_class_t cl, xcss_ns_t ns, syntree_node_t body) {
+	syntree_node_t stn, first;
+	str_it_t error = 0;
+	assert(syntree_name(body)==XCSS_NODE_BODY);
+	first = xcss_parse_body(x->temp, x->source, body, &error);
+	if(err()) {
+		diag_add(x, err_get(), 0, err_get()==e_xcss_syntax ? error : 0);
+		return;
+	}
+	if(x->stats)
+		x->stats->nodes += count_nodes(first);
+	for(stn=first; stn; stn=syntree_next(stn)) {
+		str_t nm, vl;
+		syntree_node_t i = syntree_child(stn);
+		assert(syntree_name(i)==XCSS_NODE_NAME);
+		nm = keep(x, syntree_value(i));
+		if(err())
+			return;
+		i = syntree_next(i);
+		vl = get_rule_value(x, ns, i);
+		if(err())
+			return;
+		/* node (like position of class) is used by source map only,
+		   sources are not released if it is written */
+		class_append_rule(cl, nm, vl, stn, x->smap_source);
+		if(err())
+			return;
+		XCSS_STAT_ADD(x, rules, 1);
+	}
+}
+
+/**
+ * Resolve rules of lazy class in the file it was defined in.
+ */
+static void class_resolve(xcss_t x, xcss_class_t cl) {
+	str_t file = x->file, source = x->source;
+	xcss_smap_source_t smap_source = x->smap_source;
+	xcss_class_ref_t i;
+	if(!cl->lazy)
+		return;
+	cl->lazy = 0;
+	for(i=cl->parents; i; i=i->next) {
+		class_resolve(x, i->cl);
+		if(err())
+			return;
+		class_append_class(cl, i->cl);
+		if(err())
+			return;
+	}
+	x->file = cl->file;
+	x->source = cl->content;
+	x->smap_source = cl->source;
+	class_rules(x, cl, cl->ns, cl->body);
+	if(err())
+		return;
+	x->file = file;
+	x->source = source;
+	x->smap_source = smap_source;
+}
+
+/**
+ * Next "${name}" in unparsed body from *i, name is stored to *nb and *ne.
+ * Lazy bodies are not parsed, so references are found in text, ones in
+ * comments included.
+ */
+static int body_ref(str_it_t *i, str_it_t e, str_it_t *nb, str_it_t *ne) {
+	str_it_t p = *i;
+	while((p = memchr(p, '$', e - p))) {
+		str_it_t c;
+		if(e - p<2 || p[1]!='{') {
+			p++;
+			continue;
+		}
+		c = memchr(p + 2, '}', e - p - 2);
+		if(!c)
+			break;
+		*nb = p + 2;
+		*ne = c;
+		*i = c + 1;
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Remember variables referenced by values of lazy class, so adding
+ * other variables does not resolve it.
+ */
+static void lazy_add_refs(xcss_t x, syntree_node_t body) {
+	str_it_t i = body->position, e = body->next->position, nb, ne;
+	while(body_ref(&i, e, &nb, &ne)) {
+		str_t nm = str_interval(x->heap, nb, ne);
+		if(err())
+			return;
+		map_set(x->lazy_refs, nm, nm);
+		if(err())
+			return;
+	}
+}
+
+static int lazy_refers(syntree_node_t body, str_t nm) {
+	str_it_t i = body->position, e = body->next->position, nb, ne;
+	while(body_ref(&i, e, &nb, &ne))
+		if((size_t)(ne - nb)==str_length(nm) && !memcmp(nb, str_begin(nm), ne - nb))
+			return 1;
+	return 0;
+}
+
+/**
+ * Variable nm added to ns may hide one seen by lazy classes of ns and
+ * its children, so those referring to it are resolved before.
+ */
+static void lazy_resolve_scope(xcss_t x, xcss_ns_t ns, str_t nm) {
+	xcss_class_t *p = &x->lazy, cl;
+	while((cl = *p)) {
+		if(cl->lazy) {
+			xcss_ns_t i;
+			for(i=cl->ns; i && i!=ns; i=i->parent);
+			if(!i || !lazy_refers(cl->body, nm)) {
+				p = &cl->next_lazy;
+				continue;
+			}
+			class_resolve(x, cl);
+			if(err())
+				return;
+		}
+		*p = cl->next_lazy;
+	}
+}
+
+static void xcss_process_node(xcss_t x,
+							  syntree_node_t stn,
+							  xcss_ns_t ns,
+							  str_t fprefix,
+							  str_t name_prefix) {
+	heap_t h = x->temp;
+	uint64_t ts;
+	switch(syntree_name(stn)) {
+		case XCSS_NODE_NAMESPACE: {
+			str_t nmp2;
+			xcss_ns_t ns2 = ns_create(h, ns);
+			if(err())
+				return;
+			stn = syntree_child(stn);
+			assert(syntree_name(stn)==XCSS_NODE_NAME);
+			nmp2 = syntree_value(stn);
+			if(err())
+				return;
+			str_t tmp = str_from_cs(h, "-");
+			if(err())
+				return;
+			nmp2 = str_cat(h, nmp2, tmp);
+			if(err())
+				return;
+			if(name_prefix) {
+				nmp2 = str_cat(h, name_prefix, nmp2);
+				if(err())
+					return;
+			}
+			nmp2 = keep(x, nmp2);
+			if(err())
+				return;
+			/* output is flushed at shard boundaries, so a shard gets whole buffers */
+			if(!name_prefix && x->shard_write) {
+				out_flush(x);
+				x->shard = syntree_value(stn);
+			}
+			ts = xcss_trace_begin();
+			for(stn=syntree_next(stn); stn; stn=syntree_next(stn)) {
+				xcss_process_node(x, stn, ns2, fprefix, nmp2);
+				if(err())
+					return;
+			}
+			xcss_trace_end(ts, "namespace", str_begin(nmp2), str_length(nmp2));
+			if(!name_prefix && x->shard_write) {
+				out_flush(x);
+				x->shard = 0;
+			}
+			break;
+		}
+		case XCSS_NODE_CLASS: {
+			xcss_class_t cl;
+			str_t tmp;
+			stn = syntree_child(stn);
+			assert(syntree_name(stn)==XCSS_NODE_CLASS_NAME);
+			tmp = keep(x, syntree_value(stn));
+			if(err())
+				return;
+			XCSS_STAT_ADD(x, classes, 1);
+			cl = class_create(x, tmp, name_prefix, stn->position);
+			if(err())
+				return;
+			ns_add_class(ns, cl);
+			if(err())
+				return;
+			if(x->used) {
+				cl->lazy = !class_used(x, cl);
+				if(err())
+					return;
+			}
+			stn = syntree_next(stn);
+			if(stn ? syntree_name(stn)==XCSS_NODE_CLASS_PARENT : 0) {
+				syntree_node_t i;
+				ts = xcss_trace_begin();
+				for(i=syntree_child(stn); i; i=syntree_next(i)) {
+					xcss_class_t pc;
+					tmp = syntree_value(i);
+					if(err())
+						return;
+					pc = ns_get_class(x, ns, tmp);
+					if(!pc) {
+						diag_add(x, e_xcss_class, tmp, i->position);
+						return;
+					}
+					if(cl->lazy)
+						class_add_parent(x, cl, pc);
+					else {
+						class_resolve(x, pc);
+						if(err())
+							return;
+						class_append_class(cl, pc);
+					}
+					if(err())
+						return;
+				}
+				xcss_trace_end(ts, "inherit", str_begin(cl->name), str_length(cl->name));
+				stn = syntree_next(stn);
+			}
+			if(cl->lazy) {
+				cl->body = stn;
+				cl->ns = ns;
+				cl->file = x->file;
+				cl->content = x->source;
+				cl->next_lazy = x->lazy;
+				x->lazy = cl;
+				if(!x->lazy_refs) {
+					x->lazy_refs = map_create(h);
+					if(err())
+						return;
+				}
+				lazy_add_refs(x, stn);
+				if(err())
+					return;
+				ns_add_class(ns, cl);
+				break;
+			}
+			class_rules(x, cl, ns, stn);
+			if(err())
+				return;
+			class_write(x, cl);
+			ns_add_class(ns, cl);
+			break;
+		}
+		case XCSS_NODE_RULE: {
+			str_t nm, vl;
+			syntree_node_t i = syntree_child(stn);
+			assert(syntree_name(i)==XCSS_NODE_NAME);
+			nm = syntree_value(i);
+			if(err())
+				return;
+			/* value set by caller wins, it is not evaluated */
+			if(!ns->parent && x->vars && map_get(x->vars, nm))
+				break;
+			nm = keep(x, nm);
+			if(err())
+				return;
+			i = syntree_next(i);
+			vl = get_rule_value(x, ns, i);
+			if(err())
+				return;
+			if(x->lazy && map_get(x->lazy_refs, nm)) {
+				lazy_resolve_scope(x, ns, nm);
+				if(err())
+					return;
+			}
+			ns_add_var(ns, nm, vl);
+			XCSS_STAT_ADD(x, variables, 1);
+			break;
+		}
+		case XCSS_NODE_INCLUDE: {
+			str_t fname, file, source;
+			xcss_smap_source_t smap_source;
+			heap_mark_t mark;
+			syntree_t st;
+			syntree_node_t i = syntree_child(stn);
+			assert(syntree_name(i)==XCSS_NODE_INCLUDE_NAME);
+			fname = syntree_value(i);
+			if(err())
+				return;
+			fname = xcss_include_path(h, fprefix, fname, &fprefix);
+			if(err())
+				return;
+			XCSS_STAT_ADD(x, includes, 1);
+			file = x->file;
+			source = x->source;
+			smap_source = x->smap_source;
+			if(x->scoped) {
+				x->temp = x->scratch;
+				mark = heap_mark(x->temp);
+			}
+			x->file = fname;
+			x->source = 0;
+			st = load_syntree(x, fname);
+			if(err())
+				return;
+			for(i=syntree_begin(st); i; i=syntree_next(i)) {
+				xcss_process_node(x, i, ns, fprefix, name_prefix);
+				if(err())
+					return;
+			}
+			x->file = file;
+			x->source = source;
+			x->smap_source = smap_source;
+			/* on error it is kept, diagnostics refer to sources */
+			if(x->scoped) {
+				scratch_stat(x);
+				heap_release(x->scratch, mark);
+				x->temp = h;
+			}
+		}
+	}
+}
+
+static void release_files(xcss_t x) {
+	for(; x->files; x->files=x->files->next)
+		xcss_cache_release(x->cache, x->files->file);
+}
+
+static void compile_syntree(xcss_t x, syntree_t st) {
+	syntree_node_t i;
+	xcss_ns_t ns = ns_create(x->heap, 0);
+	if(err())
+		return;
+	if(x->vars) {
+		map_node_t v;
+		for(v=map_begin(x->vars); v; v=map_next(v)) {
+			ns_add_var(ns, v->key, v->value);
+			if(err())
+				return;
+		}
+	}
+	for(i=syntree_begin(st); i; i=syntree_next(i)) {
+		xcss_process_node(x, i, ns, 0, 0);
+		if(err())
+			return;
+	}
+}
+
+/**
+ * Turn offsets of diagnostics into lines and columns. Sources may be
+ * released after compilation, so it's done here, only when it failed.
+ */
+static void diag_positions(xcss_t x) {
+	xcss_diag_t d;
+	xcss_lines_t l;
+	for(d=x->first_diag; d; d=d->next) {
+		if(!d->source)
+			continue;
+		for(l=x->lines; l && l->source!=d->source; l=l->next);
+		if(!l) {
+			l = xcss_lines_create(x->heap, d->source);
+			if(err())
+				return;
+			l->next = x->lines;
+			x->lines = l;
+		}
+		xcss_lines_find(l, d->offset, &d->line, &d->column);
+		d->source = 0;
+	}
+}
+
+static void compile_end(xcss_t x, xcss_phase_t p) {
+	if(x->first_diag) {
+		const err_t *e = err_get();
+		const char *file = err_file();
+		int line = err_line();
+		err_clear();
+		diag_positions(x);
+		err_clear();
+		err_ = e;
+		err_file_ = file;
+		err_line_ = line;
+	}
+	x->lines = 0;
+	release_files(x);
+	if(!err()) {
+		out_flush(x);
+		if(x->out_external && x->length>x->out_size)
+			diag_add(x, e_xcss_overflow, 0, 0);
+	}
+	if(x->stats) {
+		scratch_stat(x);
+		if(x->cache) {
+			heap_stat_t cs = xcss_cache_stat(x->cache, &x->stats->cache_files);
+			x->stats->cache_used = cs.used;
+			x->stats->cache_reserved = cs.reserved;
+		}
+		x->stats->output_bytes += x->length;
+		xcss_stats_phase(x->stats, p);
+	}
+}
+
+void xcss_compile(xcss_t x, str_t name, str_t source) {
+	syntree_t st = 0;
+	xcss_phase_t p = x->stats ? xcss_stats_phase(x->stats, XCSS_PHASE_EVALUATE) : 0;
+	x->file = name;
+	x->source = 0;
+	scope_begin(x);
+	if(!err())
+		source = xcss_decode(x->heap, source);
+	if(!err())
+		set_source(x, source);
+	if(err())
+		diag_add(x, err_get(), 0, 0);
+	else
+		st = parse(x);
+	if(!err())
+		compile_syntree(x, st);
+	compile_end(x, p);
+}
+
+void xcss_compile_file(xcss_t x, str_t name) {
+	syntree_t st;
+	xcss_phase_t p = x->stats ? xcss_stats_phase(x->stats, XCSS_PHASE_EVALUATE) : 0;
+	x->file = name;
+	x->source = 0;
+	scope_begin(x);
+	if(err()) {
+		diag_add(x, err_get(), 0, 0);
+		st = 0;
+	} else
+		st = load_syntree(x, name);
+	if(!err())
+		compile_syntree(x, st);
+	compile_end(x, p);
+}
@@ -0,0 +1,173 @@
+#ifndef MAY_XCSS_H
+#define MAY_XCSS_H
+
+#include "maylib/err.h"
+#include "maylib/heap.h"
+#include "maylib/str.h"
+#include "maylib/map.h"
+#include "cache.h"
+#include "stats.h"
+#include "sourcemap.h"
+
+ERR_DECLARE(e_xcss_class);
+ERR_DECLARE(e_xcss_variable);
+ERR_DECLARE(e_xcss_overflow);
+
+#define XCSS_OUT_BUFFER_SIZE (1024*16)
+
+/**
+ * Return content of included file. Content must be allocated in given heap.
+ */
+typedef str_t (*xcss_resolve_f)(void *, heap_t, str_t fname);
+typedef void (*xcss_write_f)(void *, const char *, size_t);
+/**
+ * Write output of shard, shard is name of top-level namespace or zero.
+ */
+typedef void (*xcss_shard_write_f)(void *, str_t shard, const char *, size_t);
+/**
+ * Output of one class block. Strings live only during the call.
+ */
+typedef void (*xcss_class_f)(void *, str_t selector, str_t block);
+
+typedef struct xcss_diag_ss {
+	const err_t *error;
+	str_t file;      /* zero for compiled source */
+	str_t subject;   /* class or variable name, may be zero */
+	size_t offset;   /* offset in file, XCSS_NO_OFFSET if unknown */
+	size_t line;     /* line and column of offset from 1, zero if unknown */
+	size_t column;
+	str_t source;    /* used while compiling only */
+	struct xcss_diag_ss *next;
+} xcss_diag_s;
+
+typedef xcss_diag_s *xcss_diag_t;
+
+#define XCSS_NO_OFFSET ((size_t)-1)
+
+typedef struct xcss_file_ref_ss {
+	xcss_file_t file;
+	struct xcss_file_ref_ss *next;
+} xcss_file_ref_s;
+
+typedef xcss_file_ref_s *xcss_file_ref_t;
+
+typedef struct xcss_ss {
+	heap_t heap;
+	xcss_resolve_f resolve;
+	void *resolve_data;
+	xcss_write_f write;
+	void *write_data;
+	xcss_cache_t cache;
+	xcss_file_ref_t files;
+	map_t includes;
+	char *out;
+	size_t out_size;
+	size_t out_used;
+	size_t length;
+	int out_external;
+	str_t file;
+	str_t source;
+	xcss_diag_t first_diag;
+	xcss_diag_t last_diag;
+	struct xcss_lines_ss *lines;
+	xcss_stats_t stats;
+	xcss_smap_t smap;
+	xcss_smap_source_t smap_source;  /* of current source */
+	xcss_shard_write_f shard_write;
+	void *shard_data;
+	str_t shard;                     /* top-level namespace being written */
+	map_t used;
+	struct xcss_class_ss *lazy;      /* unused classes not resolved yet */
+	map_t lazy_refs;                 /* variables used by lazy classes */
+	int threads;                     /* for parsing */
+	map_t vars;                      /* global variables set by caller */
+	xcss_class_f class_hook;
+	void *class_data;
+	char *capture;                   /* output of class being written, for hook */
+	size_t capture_used;
+	size_t capture_size;
+	int capturing;
+	heap_t scratch;                  /* of includes, released after each */
+	heap_t temp;                     /* scratch in includes, heap otherwise */
+	int scoped;                      /* includes use scratch */
+} xcss_s;
+
+typedef xcss_s *xcss_t;
+
+/**
+ * Compilation context. Contexts don't share any state (except cache),
+ * so separate contexts may be used from different threads.
+ * Results are allocated in the heap of context. Included files are read,
+ * parsed and evaluated in a scratch heap (deleted with the context), which
+ * is released when the include is processed, unless lazy classes or
+ * source map need the sources until the end.
+ * By default includes are read from files and output is dropped.
+ */
+xcss_t xcss_create(heap_t);
+void xcss_set_resolver(xcss_t, xcss_resolve_f, void *);
+void xcss_set_sink(xcss_t, xcss_write_f, void *);
+/**
+ * Write output to caller buffer. If it is too small, e_xcss_overflow
+ * is set and xcss_length returns required size.
+ */
+void xcss_set_buffer(xcss_t, char *, size_t);
+/**
+ * Write only classes whose names (with namespace prefixes) are keys of map.
+ * Other classes are resolved only if used classes inherit them, and
+ * errors in their bodies are not reported otherwise.
+ */
+void xcss_set_used(xcss_t, map_t);
+/**
+ * Write classes of every top-level namespace separately. Classes outside
+ * of namespaces go to shard zero.
+ */
+void xcss_set_shard_sink(xcss_t, xcss_shard_write_f, void *);
+/**
+ * Take included files from cache instead of resolver.
+ */
+void xcss_set_cache(xcss_t, xcss_cache_t);
+/**
+ * Add name of every included file to map.
+ */
+void xcss_set_includes(xcss_t, map_t);
+/**
+ * Collect statistics of compilation to stats (initialized by caller).
+ */
+void xcss_set_stats(xcss_t, xcss_stats_t);
+/**
+ * Write source map of output. Map is finished by the caller with
+ * xcss_smap_end after compilation.
+ */
+void xcss_set_source_map(xcss_t, xcss_smap_t);
+
+/**
+ * Call f with output of every written class, so callers can compare
+ * outputs of compilations.
+ */
+void xcss_set_class_hook(xcss_t, xcss_class_f, void *);
+/**
+ * Global variables (names to values) set by caller. They replace
+ * definitions of the same names outside of namespaces, so one parsed
+ * source is compiled with different values.
+ */
+void xcss_set_vars(xcss_t, map_t);
+/**
+ * Parse large files with up to n threads, see xcss_to_syntree_parallel.
+ */
+void xcss_set_threads(xcss_t, int n);
+
+/**
+ * Compile source. Name is used for diagnostics and may be zero.
+ * On error, err() is set and diagnostics are available.
+ */
+void xcss_compile(xcss_t, str_t name, str_t source);
+/**
+ * Compile file, using cache if it is set.
+ */
+void xcss_compile_file(xcss_t, str_t name);
+size_t xcss_length(xcss_t);
+xcss_diag_t xcss_diagnostics(xcss_t);
+
+void xcss_file_sink(void *, const char *, size_t);
+
+#endif /* MAY_XCSS_H */